@@ -0,0 +1,242 @@
+#include <inc/x86.h>
+#include <inc/elf.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/boot.h>
+#include <inc/ide.h>
+
+/**********************************************************************
+ * Second stage of the boot loader.
+ *
+ * boot.S and main.c have to fit in the boot sector, so all they can
+ * do is read this program off the sectors right after the boot sector
+ * (one PIO command at a time) and jump to it.  We have more room, so
+ * we load the kernel with PCI bus-master DMA when the IDE controller
+ * supports it, falling back to PIO otherwise, then jump to the kernel.
+ *
+ * The kernel image starts at sector KERN_SECT, which boot/Makefrag
+ * passes in on the command line.  It is either a plain ELF executable
+ * or a compressed image made by boot/mkzimage.c (see inc/boot.h), in
+ * which case we decompress each segment as we load it.
+ **********************************************************************/
+
+#define ELFHDR		((struct Elf *) 0x10000) // scratch space
+#define ZHDR		((struct Zhdr *) 0x10000)
+#define BOOTINFO	((struct Bootinfo *) BOOTINFO_PADDR)
+
+// Aligned to its own size so that it can't cross a 64KB boundary.
+static struct IdePrd prdt[IDE_NPRD] __attribute__((aligned(sizeof(struct IdePrd) * IDE_NPRD)));
+static bool use_dma;
+
+int readseg(uint32_t, uint32_t, uint32_t);
+int load_elf(void);
+int load_zimage(void);
+
+void
+loadermain(void)
+{
+	uint32_t entry;
+
+	BOOTINFO->bi_magic = BOOTINFO_MAGIC;
+	BOOTINFO->bi_flags = 0;
+	BOOTINFO->bi_tsc[BT_LOADER] = read_tsc();
+
+	// We run with an identity segment mapping (see boot.S), so the
+	// PRD table's physical address is just its address.
+	use_dma = ide_dma_init(prdt, (physaddr_t) prdt);
+
+	// read 1st page off disk
+	if (readseg((uint32_t) ELFHDR, SECTSIZE*8, 0) < 0)
+		goto bad;
+
+	if (ZHDR->zh_magic == ZIMAGE_MAGIC) {
+		entry = ZHDR->zh_entry;
+		if (load_zimage() < 0)
+			goto bad;
+		BOOTINFO->bi_flags |= BI_ZIMAGE;
+	} else if (ELFHDR->e_magic == ELF_MAGIC) {
+		entry = ELFHDR->e_entry;
+		if (load_elf() < 0)
+			goto bad;
+	} else
+		goto bad;
+
+	if (use_dma)
+		BOOTINFO->bi_flags |= BI_DMA;
+	BOOTINFO->bi_flags |= BI_BSS_CLEAN;
+	BOOTINFO->bi_tsc[BT_LOADED] = read_tsc();
+
+	// call the entry point from the image header
+	// note: does not return!
+	((void (*)(void)) entry)();
+
+bad:
+	outw(0x8A00, 0x8A00);
+	outw(0x8A00, 0x8E00);
+	while (1)
+		/* do nothing */;
+}
+
+// Zero the 'count' bytes at physical address 'pa', a word at a time
+// for all but the unaligned ends.  This is how segments get their
+// BSS: only the file-backed part of a segment is read off the disk.
+static void
+zeroseg(uint32_t pa, uint32_t count)
+{
+	uint32_t n;
+
+	n = MIN(-pa & 3, count);
+	count -= n;
+	asm volatile("cld; rep stosb"
+		     : "+D" (pa), "+c" (n) : "a" (0) : "cc", "memory");
+	n = count / 4;
+	asm volatile("rep stosl"
+		     : "+D" (pa), "+c" (n) : "a" (0) : "cc", "memory");
+	n = count & 3;
+	asm volatile("rep stosb"
+		     : "+D" (pa), "+c" (n) : "a" (0) : "cc", "memory");
+}
+
+int
+load_elf(void)
+{
+	struct Proghdr *ph, *eph;
+	int r;
+
+	// load each program segment (ignores ph flags)
+	ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
+	eph = ph + ELFHDR->e_phnum;
+	for (; ph < eph; ph++) {
+		// p_pa is the load address of this segment (as well
+		// as the physical address)
+		if ((r = readseg(ph->p_pa, ph->p_filesz, ph->p_offset)) < 0)
+			return r;
+		// readseg may have read past p_filesz, so zero afterwards
+		zeroseg(ph->p_pa + ph->p_filesz, ph->p_memsz - ph->p_filesz);
+	}
+	return 0;
+}
+
+// Expand the LZ4 block of 'srclen' bytes at 'src' into 'dst', which
+// has room for 'dstlen' bytes.  Returns the number of bytes produced,
+// or -1 if the block is malformed.
+static int
+lz4_decompress(uint8_t *dst, uint32_t dstlen, const uint8_t *src,
+	       uint32_t srclen)
+{
+	const uint8_t *send = src + srclen, *match;
+	uint8_t *d = dst, *dend = dst + dstlen;
+	uint32_t len, off;
+	uint8_t token, b;
+
+	while (src < send) {
+		token = *src++;
+
+		// literal run
+		len = token >> 4;
+		if (len == 15)
+			do {
+				if (src == send)
+					return -1;
+				len += b = *src++;
+			} while (b == 255);
+		if (len > send - src || len > dend - d)
+			return -1;
+		memcpy(d, src, len);
+		d += len;
+		src += len;
+
+		// the last sequence has no match
+		if (src == send)
+			break;
+
+		// match: 2-byte offset back into the output, then length
+		if (send - src < 2)
+			return -1;
+		off = src[0] | (src[1] << 8);
+		src += 2;
+		if (off == 0 || off > d - dst)
+			return -1;
+		len = token & 15;
+		if (len == 15)
+			do {
+				if (src == send)
+					return -1;
+				len += b = *src++;
+			} while (b == 255);
+		len += 4;
+		if (len > dend - d)
+			return -1;
+		match = d - off;
+		if (off >= len) {
+			memcpy(d, match, len);
+			d += len;
+		} else
+			// an overlapping match repeats the last 'off' bytes
+			while (len-- > 0)
+				*d++ = *match++;
+	}
+	return d - dst;
+}
+
+// Load a kernel compressed by boot/mkzimage.c.  Each segment's LZ4
+// block is read into the free memory just past where the segment will
+// end up (BSS included), then expanded into place from there.
+int
+load_zimage(void)
+{
+	struct Zseg *zs, *ezs;
+	uint32_t stage;
+	int r;
+
+	if (ZHDR->zh_nseg > ZIMAGE_MAXSEG)
+		return -E_INVAL;
+
+	zs = (struct Zseg *) (ZHDR + 1);
+	ezs = zs + ZHDR->zh_nseg;
+	for (; zs < ezs; zs++) {
+		stage = ROUNDUP(zs->zs_pa + zs->zs_memsz, SECTSIZE);
+		if ((r = readseg(stage, zs->zs_zsize, zs->zs_offset)) < 0)
+			return r;
+		if (lz4_decompress((uint8_t *) zs->zs_pa, zs->zs_filesz,
+				   (const uint8_t *) stage, zs->zs_zsize)
+		    != zs->zs_filesz)
+			return -E_INVAL;
+		zeroseg(zs->zs_pa + zs->zs_filesz, zs->zs_memsz - zs->zs_filesz);
+	}
+	return 0;
+}
+
+// Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
+// Might copy more than asked
+int
+readseg(uint32_t pa, uint32_t count, uint32_t offset)
+{
+	uint32_t end_pa, nsect;
+	int r;
+
+	end_pa = pa + count;
+
+	// round down to sector boundary
+	pa &= ~(SECTSIZE - 1);
+
+	// translate from bytes to sectors, and kernel starts at KERN_SECT
+	offset = (offset / SECTSIZE) + KERN_SECT;
+
+	while (pa < end_pa) {
+		nsect = MIN((end_pa - pa + SECTSIZE - 1) / SECTSIZE,
+			    IDE_MAXSECT);
+		r = -1;
+		if (use_dma && (r = ide_dma_start(offset, pa, nsect, 0)) == 0)
+			r = ide_dma_wait();
+		if (r < 0) {
+			// DMA is missing or broken; stick to PIO from now on.
+			use_dma = false;
+			if ((r = ide_pio_read(offset, (void *) pa, nsect)) < 0)
+				return r;
+		}
+		pa += nsect * SECTSIZE;
+		offset += nsect;
+	}
+	return 0;
+}
@@ -1,17 +1,21 @@
 #include <inc/x86.h>
 #include <inc/elf.h>
+#include <inc/boot.h>
 
 /**********************************************************************
  * This a dirt simple boot loader, whose sole job is to boot
- * an ELF kernel image from the first IDE hard disk.
+ * an ELF image from the first IDE hard disk.
  *
  * DISK LAYOUT
- *  * This program(boot.S and main.c) is the bootloader.  It should
- *    be stored in the first sector of the disk.
+ *  * This program(boot.S and main.c) is the first stage of the
+ *    bootloader.  It should be stored in the first sector of the disk.
  *
- *  * The 2nd sector onward holds the kernel image.
+ *  * The 2nd sector onward holds the second stage (loader.c), which
+ *    is too big for the boot sector.  It loads the kernel image, which
+ *    starts at sector KERN_SECT (see boot/Makefrag).
  *
- *  * The kernel image must be in ELF format.
+ *  * The second stage must be in ELF format.  The kernel image is the
+ *    kernel ELF compressed by mkzimage.c.
  *
  * BOOT UP STEPS
  *  * when the CPU boots it loads the BIOS into memory and executes it
@@ -26,19 +30,25 @@
  *  * control starts in boot.S -- which sets up protected mode,
  *    and a stack so C code then run, then calls bootmain()
  *
- *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
+ *  * bootmain() in this file takes over, reads in the second stage and
+ *    jumps to it; loadermain() in loader.c then does the same for the
+ *    kernel.
  **********************************************************************/
 
 #define SECTSIZE	512
 #define ELFHDR		((struct Elf *) 0x10000) // scratch space
+#define BOOTINFO	((struct Bootinfo *) BOOTINFO_PADDR)
 
-void readsect(void*, uint32_t);
+void readsects(void*, uint32_t, uint32_t);
 void readseg(uint32_t, uint32_t, uint32_t);
 
 void
 bootmain(void)
 {
 	struct Proghdr *ph, *eph;
+	uint32_t pa, n;
+
+	BOOTINFO->bi_tsc[BT_BOOTMAIN] = read_tsc();
 
 	// read 1st page off disk
 	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
@@ -50,10 +60,16 @@ bootmain(void)
 	// load each program segment (ignores ph flags)
 	ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
 	eph = ph + ELFHDR->e_phnum;
-	for (; ph < eph; ph++)
+	for (; ph < eph; ph++) {
 		// p_pa is the load address of this segment (as well
-		// as the physical address)
-		readseg(ph->p_pa, ph->p_memsz, ph->p_offset);
+		// as the physical address).  Only p_filesz bytes are in
+		// the file; the rest (the BSS) must start out zero, and
+		// readseg may have read past p_filesz, so zero afterwards.
+		readseg(ph->p_pa, ph->p_filesz, ph->p_offset);
+		pa = ph->p_pa + ph->p_filesz;
+		n = ph->p_memsz - ph->p_filesz;
+		asm volatile("rep stosb" : "+D" (pa), "+c" (n) : "a" (0) : "memory");
+	}
 
 	// call the entry point from the ELF header
 	// note: does not return!
@@ -66,33 +82,32 @@ bad:
 		/* do nothing */;
 }
 
-// Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
+// Read 'count' bytes at 'offset' from the image into physical address 'pa'.
 // Might copy more than asked
+//
+// The whole image is less than KERN_SECT sectors (boot/Makefrag checks
+// this), so any run of it takes a single READ SECTORS command, which
+// can read up to 256.  We'd write more to memory than asked, but it
+// doesn't matter -- we load in increasing order.
 void
 readseg(uint32_t pa, uint32_t count, uint32_t offset)
 {
 	uint32_t end_pa;
 
+	// A sector count of 0 would mean 256.
+	if (count == 0)
+		return;
+
 	end_pa = pa + count;
 
 	// round down to sector boundary
 	pa &= ~(SECTSIZE - 1);
 
-	// translate from bytes to sectors, and kernel starts at sector 1
-	offset = (offset / SECTSIZE) + 1;
-
-	// If this is too slow, we could read lots of sectors at a time.
-	// We'd write more to memory than asked, but it doesn't matter --
-	// we load in increasing order.
-	while (pa < end_pa) {
-		// Since we haven't enabled paging yet and we're using
-		// an identity segment mapping (see boot.S), we can
-		// use physical addresses directly.  This won't be the
-		// case once JOS enables the MMU.
-		readsect((uint8_t*) pa, offset);
-		pa += SECTSIZE;
-		offset++;
-	}
+	// Since we haven't enabled paging yet and we're using an identity
+	// segment mapping (see boot.S), we can use physical addresses
+	// directly.  The image starts at sector 1.
+	readsects((uint8_t*) pa, (offset / SECTSIZE) + 1,
+		  (end_pa - pa + SECTSIZE - 1) / SECTSIZE);
 }
 
 void
@@ -103,23 +118,29 @@ waitdisk(void)
 		/* do nothing */;
 }
 
+// Read 'nsect' (1 to 256) consecutive sectors starting at sector
+// 'offset' into 'dst' with a single READ SECTORS command.  The drive
+// drops BSY and raises DRQ once per sector as each one lands in its
+// buffer, so we simply wait for it to be ready again between sectors.
 void
-readsect(void *dst, uint32_t offset)
+readsects(void *dst, uint32_t offset, uint32_t nsect)
 {
 	// wait for disk to be ready
 	waitdisk();
 
-	outb(0x1F2, 1);		// count = 1
+	outb(0x1F2, nsect);	// count; 0 means 256
 	outb(0x1F3, offset);
 	outb(0x1F4, offset >> 8);
 	outb(0x1F5, offset >> 16);
 	outb(0x1F6, (offset >> 24) | 0xE0);
 	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
 
-	// wait for disk to be ready
-	waitdisk();
+	while (nsect-- > 0) {
+		// wait for the next sector to be ready
+		waitdisk();
 
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+		// read a sector
+		insl(0x1F0, dst, SECTSIZE/4);
+		dst += SECTSIZE;
+	}
 }
-
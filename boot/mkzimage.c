@@ -0,0 +1,233 @@
+/*
+ * Turn the kernel ELF into a compressed kernel image for boot/loader.c.
+ *
+ * Each loadable segment is compressed as a single LZ4 block (the raw
+ * block format, without the frame header) so that the loader reads
+ * fewer sectors off the disk.  See struct Zhdr in inc/boot.h for the
+ * image layout.
+ *
+ * Usage: mkzimage kernel-elf zimage
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+// Prevent inc/types.h, included from inc/boot.h,
+// from attempting to redefine types defined in the host's stdint.h.
+#define JOS_INC_TYPES_H
+#include <inc/elf.h>
+#include <inc/boot.h>
+
+#define SECTSIZE	512
+
+// LZ4 format parameters
+#define MINMATCH	4	// shortest match that can be encoded
+#define MAXOFFSET	65535	// farthest back a match can point
+#define LASTLITERALS	5	// the last bytes must be literals
+#define MFLIMIT		12	// no match may start this close to the end
+
+#define HASH_LOG	16
+
+static uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint32_t
+hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// Append a run length continuation: 'len' encoded as bytes of 255
+// followed by a final byte less than 255.
+static uint8_t *
+put_length(uint8_t *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+// Append one LZ4 sequence: 'nlit' literal bytes from 'lit', then a
+// match of 'mlen' bytes 'off' bytes back.  'mlen' of 0 means the final,
+// literals-only sequence.
+static uint8_t *
+put_sequence(uint8_t *op, const uint8_t *lit, size_t nlit,
+	     size_t off, size_t mlen)
+{
+	uint8_t *token = op++;
+
+	*token = (nlit < 15 ? nlit : 15) << 4;
+	if (nlit >= 15)
+		op = put_length(op, nlit - 15);
+	memcpy(op, lit, nlit);
+	op += nlit;
+
+	if (mlen == 0)
+		return op;
+
+	*op++ = off & 0xFF;
+	*op++ = off >> 8;
+	mlen -= MINMATCH;
+	*token |= mlen < 15 ? mlen : 15;
+	if (mlen >= 15)
+		op = put_length(op, mlen - 15);
+	return op;
+}
+
+// Greedy single-pass LZ4 compressor.  'dst' must have room for
+// lz4_bound(n) bytes.  Returns the size of the compressed block.
+static size_t
+lz4_compress(const uint8_t *src, size_t n, uint8_t *dst)
+{
+	static int32_t table[1 << HASH_LOG];
+	const uint8_t *ip = src, *anchor = src, *iend = src + n;
+	const uint8_t *ref;
+	uint8_t *op = dst;
+	uint32_t h;
+	size_t mlen;
+
+	memset(table, 0xFF, sizeof(table));
+
+	while (n >= MFLIMIT && ip < iend - MFLIMIT) {
+		h = hash(read32(ip));
+		ref = table[h] < 0 ? NULL : src + table[h];
+		table[h] = ip - src;
+		if (!ref || ip - ref > MAXOFFSET || read32(ref) != read32(ip)) {
+			ip++;
+			continue;
+		}
+
+		// Extend the match forward, keeping clear of the tail.
+		mlen = MINMATCH;
+		while (ip + mlen < iend - LASTLITERALS && ip[mlen] == ref[mlen])
+			mlen++;
+
+		op = put_sequence(op, anchor, ip - anchor, ip - ref, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+
+	return put_sequence(op, anchor, iend - anchor, 0, 0) - dst;
+}
+
+static size_t
+lz4_bound(size_t n)
+{
+	return n + n / 255 + 16;
+}
+
+static void
+xwrite(FILE *f, const void *p, size_t n, const char *name)
+{
+	if (fwrite(p, 1, n, f) != n) {
+		fprintf(stderr, "write %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *in, *out;
+	uint8_t *elf, *zbuf, hdrsect[SECTSIZE], pad[SECTSIZE];
+	long elfsize;
+	struct Elf *eh;
+	struct Proghdr *ph;
+	struct Zhdr *zh;
+	struct Zseg *zs;
+	uint32_t off, rawsize = 0, zsize = 0;
+	int i;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: mkzimage kernel-elf zimage\n");
+		exit(2);
+	}
+
+	if ((in = fopen(argv[1], "rb")) == NULL) {
+		fprintf(stderr, "open %s: %s\n", argv[1], strerror(errno));
+		exit(1);
+	}
+	fseek(in, 0, SEEK_END);
+	elfsize = ftell(in);
+	rewind(in);
+	if ((elf = malloc(elfsize)) == NULL
+	    || fread(elf, 1, elfsize, in) != (size_t) elfsize) {
+		fprintf(stderr, "read %s: %s\n", argv[1], strerror(errno));
+		exit(1);
+	}
+	fclose(in);
+
+	eh = (struct Elf *) elf;
+	if (elfsize < (long) sizeof(*eh) || eh->e_magic != ELF_MAGIC) {
+		fprintf(stderr, "%s: not an ELF file\n", argv[1]);
+		exit(1);
+	}
+
+	if ((out = fopen(argv[2], "wb")) == NULL) {
+		fprintf(stderr, "open %s: %s\n", argv[2], strerror(errno));
+		exit(1);
+	}
+
+	memset(hdrsect, 0, sizeof(hdrsect));
+	memset(pad, 0, sizeof(pad));
+	zh = (struct Zhdr *) hdrsect;
+	zh->zh_magic = ZIMAGE_MAGIC;
+	zh->zh_entry = eh->e_entry;
+	zh->zh_nseg = 0;
+	zs = (struct Zseg *) (zh + 1);
+
+	// Leave room for the header sector, then write out the segments.
+	xwrite(out, hdrsect, SECTSIZE, argv[2]);
+	off = SECTSIZE;
+
+	ph = (struct Proghdr *) (elf + eh->e_phoff);
+	for (i = 0; i < eh->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD || ph->p_memsz == 0)
+			continue;
+		if (zh->zh_nseg == ZIMAGE_MAXSEG) {
+			fprintf(stderr, "%s: too many segments\n", argv[1]);
+			exit(1);
+		}
+		if (ph->p_offset + ph->p_filesz > (uint32_t) elfsize) {
+			fprintf(stderr, "%s: truncated segment\n", argv[1]);
+			exit(1);
+		}
+
+		zbuf = malloc(lz4_bound(ph->p_filesz));
+		zs->zs_pa = ph->p_pa;
+		zs->zs_filesz = ph->p_filesz;
+		zs->zs_memsz = ph->p_memsz;
+		zs->zs_offset = off;
+		zs->zs_zsize = lz4_compress(elf + ph->p_offset, ph->p_filesz,
+					    zbuf);
+		xwrite(out, zbuf, zs->zs_zsize, argv[2]);
+		xwrite(out, pad, -zs->zs_zsize & (SECTSIZE - 1), argv[2]);
+		off += (zs->zs_zsize + SECTSIZE - 1) & ~(SECTSIZE - 1);
+		free(zbuf);
+
+		rawsize += ph->p_filesz;
+		zsize += zs->zs_zsize;
+		zh->zh_nseg++;
+		zs++;
+	}
+
+	rewind(out);
+	xwrite(out, hdrsect, SECTSIZE, argv[2]);
+	if (fclose(out) != 0) {
+		fprintf(stderr, "close %s: %s\n", argv[2], strerror(errno));
+		exit(1);
+	}
+
+	printf("%s: %u bytes compressed to %u\n", argv[2], rawsize, zsize);
+	return 0;
+}
@@ -0,0 +1,111 @@
+#ifndef JOS_INC_BOOT_H
+#define JOS_INC_BOOT_H
+
+#ifndef __ASSEMBLER__
+#include <inc/types.h>
+#endif /* not __ASSEMBLER__ */
+
+/*
+ * The boot loader leaves a small record at a fixed physical address
+ * describing what it did, for the kernel to pick up once it is running.
+ * The record lives in free conventional memory well below the boot
+ * sector and its stack; the kernel must consume it before it starts
+ * handing out low physical pages.
+ */
+#define BOOTINFO_PADDR	0x1000
+#define BOOTINFO_MAGIC	0x4A4F5342	/* "BSOJ" in little endian */
+
+/*
+ * Boot timeline.  Each stage of the boot stamps the TSC into bi_tsc
+ * when it reaches one of these points, so that the kernel can tell
+ * where startup time goes (see the 'boottime' monitor command).
+ */
+#define BT_BOOTSECT	0	// boot.S starts running
+#define BT_BOOTMAIN	1	// bootmain() starts reading the loader
+#define BT_LOADER	2	// loadermain() starts reading the kernel
+#define BT_LOADED	3	// loader is about to jump to the kernel
+#define BT_ENTRY	4	// entry.S starts running
+#define BT_PAGING	5	// entry.S has turned on paging
+#define BT_I386_INIT	6	// i386_init() has cleared the BSS
+#define BT_CONS_INIT	7	// console is up
+#define BT_MEM_INIT	8	// page tables and page allocator are up
+#define BT_KMEM_INIT	9	// kernel object allocator is up
+#define BT_IPC_INIT	10	// IPC self-checks are done
+#define BT_FPU_INIT	11	// FPU is set up
+#define BT_TSC_INIT	12	// TSC clock is calibrated
+#define BT_TIMER_INIT	13	// timer wheel is up
+#define BT_DISK_INIT	14	// disk is probed
+#define BT_BACKTRACE	15	// test_backtrace() is done
+#define BT_MONITOR	16	// kernel monitor is about to prompt
+#define BT_NPHASE	17
+
+// Physical address of the stamp for a timeline point, for assembly
+// code; must match the layout of struct Bootinfo.
+#define BOOTINFO_TSC(bt)	(BOOTINFO_PADDR + 8 + 8 * (bt))
+
+/*
+ * Physical memory map, as returned by the BIOS's E820 call (INT 15h,
+ * AX=E820h), which boot.S makes while still in real mode.  Entries of
+ * the multiboot memory map have the same layout.
+ */
+#define SMAP		0x534D4150	/* "SMAP", E820 signature */
+#define MMAP_ENTSIZE	20		// bytes per entry
+#define MMAP_MAX	32		// entries kept in the record
+
+#define MMAP_RAM	1	// usable RAM
+#define MMAP_RESERVED	2	// in use or reserved by the system
+#define MMAP_ACPI	3	// ACPI tables, reclaimable
+#define MMAP_NVS	4	// ACPI non-volatile storage
+#define MMAP_UNUSABLE	5	// bad memory
+
+// Physical addresses of bi_mmapend and bi_mmap, for boot.S.
+#define BOOTINFO_MMAPEND	BOOTINFO_TSC(BT_NPHASE)
+#define BOOTINFO_MMAP		(BOOTINFO_MMAPEND + 4)
+
+#ifndef __ASSEMBLER__
+
+struct Mmap {
+	uint64_t mm_addr;	// start of the region
+	uint64_t mm_len;	// length of the region in bytes
+	uint32_t mm_type;	// MMAP_* above
+} __attribute__((packed));
+
+struct Bootinfo {
+	uint32_t bi_magic;		// BOOTINFO_MAGIC if written by boot/
+	uint32_t bi_flags;		// BI_* below
+	uint64_t bi_tsc[BT_NPHASE];	// timeline, indexed by BT_*
+	uint16_t bi_mmapend;		// physical address past the last entry
+	uint16_t bi_pad;
+	struct Mmap bi_mmap[MMAP_MAX];	// physical memory map
+} __attribute__((packed));
+
+#define BI_DMA		0x1	// Kernel was read by bus-master DMA
+#define BI_ZIMAGE	0x2	// Kernel was decompressed from a zimage
+#define BI_BSS_CLEAN	0x4	// Loader zeroed each segment past its file data
+
+/*
+ * Compressed kernel image, made from the kernel ELF by boot/mkzimage.c.
+ * The first sector holds a Zhdr followed by zh_nseg Zseg descriptors.
+ * Each segment's file bytes are stored as one LZ4 block starting on a
+ * sector boundary.
+ */
+#define ZIMAGE_MAGIC	0x474D495AU	/* "ZIMG" in little endian */
+#define ZIMAGE_MAXSEG	16
+
+struct Zhdr {
+	uint32_t zh_magic;	// must equal ZIMAGE_MAGIC
+	uint32_t zh_entry;	// physical entry point
+	uint32_t zh_nseg;	// number of Zsegs that follow
+};
+
+struct Zseg {
+	uint32_t zs_pa;		// load address
+	uint32_t zs_filesz;	// bytes of data once decompressed
+	uint32_t zs_memsz;	// bytes of memory occupied
+	uint32_t zs_offset;	// image offset of the LZ4 block
+	uint32_t zs_zsize;	// bytes in the LZ4 block
+};
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_BOOT_H */
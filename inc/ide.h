@@ -0,0 +1,73 @@
+#ifndef JOS_INC_IDE_H
+#define JOS_INC_IDE_H
+
+#include <inc/types.h>
+
+/*
+ * Minimal driver for the master disk on the primary IDE channel,
+ * shared by the boot loader and the kernel (see lib/ide.c).
+ * Sectors can be moved either by PIO, with the CPU copying every word
+ * through the data port, or by the PCI bus-master DMA engine of a
+ * PIIX-style controller, which copies straight to memory while the CPU
+ * does something else.  DMA addresses are physical.
+ */
+
+#define SECTSIZE	512	// bytes per disk sector
+#define IDE_MAXSECT	256	// sectors per disk command
+
+// Primary channel task file
+#define IDE_DATA	0x1F0
+#define IDE_NSECT	0x1F2
+#define IDE_LBA0	0x1F3
+#define IDE_LBA1	0x1F4
+#define IDE_LBA2	0x1F5
+#define IDE_DRIVE	0x1F6
+#define IDE_STATUS	0x1F7	// read
+#define IDE_CMD		0x1F7	// write
+
+// Status register bits
+#define IDE_BSY		0x80
+#define IDE_DRDY	0x40
+#define IDE_DF		0x20
+#define IDE_DRQ		0x08
+#define IDE_ERR		0x01
+
+// Commands
+#define IDE_CMD_READ		0x20
+#define IDE_CMD_WRITE		0x30
+#define IDE_CMD_READ_DMA	0xC8
+#define IDE_CMD_WRITE_DMA	0xCA
+
+// Bus-master registers for the primary channel, relative to BAR4
+#define BM_CMD		0
+#define   BM_CMD_START	0x01	//   Start/stop bus master
+#define   BM_CMD_READ	0x08	//   Transfer from disk to memory
+#define BM_STATUS	2
+#define   BM_ST_ACTIVE	0x01	//   Bus master is transferring
+#define   BM_ST_ERR	0x02	//   Transfer failed (write 1 to clear)
+#define   BM_ST_INTR	0x04	//   Drive raised its IRQ (write 1 to clear)
+#define BM_PRDT		4	// Physical address of the PRD table
+
+// Physical region descriptor.  A region may not cross a 64KB boundary
+// and a count of 0 means 64KB.  The table itself must be 4-byte aligned
+// and may not cross a 64KB boundary either.
+struct IdePrd {
+	uint32_t prd_addr;
+	uint16_t prd_count;
+	uint16_t prd_flags;
+};
+
+#define PRD_EOT		0x8000	// Last descriptor in the table
+
+// IDE_MAXSECT sectors (128KB) span at most three 64KB windows.
+#define IDE_NPRD	4
+
+int	ide_pio_read(uint32_t secno, void *dst, size_t nsecs);
+int	ide_pio_write(uint32_t secno, const void *src, size_t nsecs);
+
+bool	ide_dma_init(struct IdePrd *prdt, physaddr_t prdt_pa);
+int	ide_dma_start(uint32_t secno, physaddr_t pa, size_t nsecs, bool write);
+int	ide_dma_poll(void);
+int	ide_dma_wait(void);
+
+#endif /* !JOS_INC_IDE_H */
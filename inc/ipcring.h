@@ -0,0 +1,153 @@
+#ifndef JOS_INC_IPCRING_H
+#define JOS_INC_IPCRING_H
+
+#include <inc/types.h>
+#include <inc/error.h>
+#include <inc/string.h>
+
+/*
+ * A single-producer, single-consumer message ring in memory that two
+ * environments share (see ipc_ring_create in kern/ipc.c).  Messages go
+ * through it with ordinary loads and stores; the kernel is only needed
+ * to wake up a peer that went to sleep waiting on the ring.
+ *
+ * The ring is a power-of-two number of slots, filling whole pages,
+ * followed by a page holding the struct IpcRing.  Each side reaches it
+ * through its own struct IpcRingEnd, which keeps a private copy of the
+ * slot count: the peer can scribble on anything in the shared pages,
+ * so nothing read from them is trusted to index the ring or to size a
+ * copy.  A bad peer can only garble the messages it exchanges.
+ *
+ * r_head and r_tail count the messages ever sent and received.  Only
+ * the producer writes r_head and only the consumer writes r_tail, and
+ * they are on separate cache lines so the two sides don't contend.
+ * x86 doesn't reorder stores with other stores, so a compiler barrier
+ * is enough to make a message visible before the r_head that covers
+ * it (and likewise for r_tail).
+ *
+ * To sleep, a side first sets its wait flag and then checks the ring
+ * once more (ipcring_prepare_wait), so the other side can't miss it:
+ * put and get report through '*wake' that the peer is asleep and
+ * must be woken.  Both orders -- flag then counter, and counter then
+ * flag -- are a store followed by a load, which x86 may reorder, so
+ * each side bumps its counter with a locked instruction, which is a
+ * full barrier.
+ */
+
+#define IPCRING_MSGSIZE	64			// bytes per slot
+#define IPCRING_MAXLEN	(IPCRING_MSGSIZE - 4)	// bytes of data per message
+
+struct IpcMsg {
+	volatile uint32_t m_len;
+	uint8_t m_data[IPCRING_MAXLEN];
+};
+
+struct IpcRing {
+	volatile uint32_t r_head;	// written by the producer
+	volatile uint32_t r_pwait;	// producer is waiting for room
+	uint8_t r_pad0[56];
+	volatile uint32_t r_tail;	// written by the consumer
+	volatile uint32_t r_cwait;	// consumer is waiting for messages
+	uint8_t r_pad1[56];
+};
+
+// One side's view of a ring.
+struct IpcRingEnd {
+	struct IpcRing *e_ring;
+	struct IpcMsg *e_slots;
+	uint32_t e_nslots;		// a power of two
+};
+
+#define ipcring_barrier()	asm volatile("" : : : "memory")
+
+// Set up 'e' for the ring with 'nslots' slots (as ipc_ring_create
+// returned) mapped at 'va'.
+static inline void
+ipcring_attach(struct IpcRingEnd *e, void *va, uint32_t nslots)
+{
+	e->e_slots = va;
+	e->e_ring = (struct IpcRing *) &e->e_slots[nslots];
+	e->e_nslots = nslots;
+}
+
+static inline void
+ipcring_advance(volatile uint32_t *counter)
+{
+	asm volatile("lock; incl %0" : "+m" (*counter) : : "memory");
+}
+
+// Send 'len' bytes from 'msg'.  Returns false if the ring is full.
+static inline bool
+ipcring_put(struct IpcRingEnd *e, const void *msg, size_t len, bool *wake)
+{
+	struct IpcRing *r = e->e_ring;
+	struct IpcMsg *m;
+
+	if (len > IPCRING_MAXLEN || r->r_head - r->r_tail == e->e_nslots)
+		return false;
+	m = &e->e_slots[r->r_head & (e->e_nslots - 1)];
+	m->m_len = len;
+	memcpy(m->m_data, msg, len);
+	ipcring_barrier();
+	ipcring_advance(&r->r_head);
+	*wake = r->r_cwait;
+	return true;
+}
+
+// Receive a message into 'buf', which has room for IPCRING_MAXLEN
+// bytes.  Returns its length, -1 if the ring is empty, or -E_INVAL
+// (having dropped it) if the message claims to be too long.
+static inline int
+ipcring_get(struct IpcRingEnd *e, void *buf, bool *wake)
+{
+	struct IpcRing *r = e->e_ring;
+	struct IpcMsg *m;
+	uint32_t len;
+
+	if (r->r_tail == r->r_head)
+		return -1;
+	ipcring_barrier();
+	m = &e->e_slots[r->r_tail & (e->e_nslots - 1)];
+	// Read the length just once: the producer may change it under us.
+	len = m->m_len;
+	if (len <= IPCRING_MAXLEN)
+		memcpy(buf, m->m_data, len);
+	ipcring_barrier();
+	ipcring_advance(&r->r_tail);
+	*wake = r->r_pwait;
+	return len <= IPCRING_MAXLEN ? (int) len : -E_INVAL;
+}
+
+// Get ready to sleep until the ring has a message (consumer) or
+// room for one (producer).  Returns false, and doesn't leave the
+// flag set, if there is no need to sleep after all.  Clear the flag
+// with ipcring_wait_done on waking.
+static inline bool
+ipcring_prepare_wait(struct IpcRingEnd *e, bool producer)
+{
+	struct IpcRing *r = e->e_ring;
+	volatile uint32_t *flag = producer ? &r->r_pwait : &r->r_cwait;
+	uint32_t one = 1;
+	bool ready;
+
+	// xchg is locked, so it is a full barrier too.
+	asm volatile("xchgl %0, %1" : "+r" (one), "+m" (*flag) : : "memory");
+	if (producer)
+		ready = r->r_head - r->r_tail < e->e_nslots;
+	else
+		ready = r->r_tail != r->r_head;
+	if (ready)
+		*flag = 0;
+	return !ready;
+}
+
+static inline void
+ipcring_wait_done(struct IpcRingEnd *e, bool producer)
+{
+	if (producer)
+		e->e_ring->r_pwait = 0;
+	else
+		e->e_ring->r_cwait = 0;
+}
+
+#endif /* !JOS_INC_IPCRING_H */
@@ -50,7 +50,9 @@
  *    UVPT      ---->  +------------------------------+ 0xef400000
  *                     |          RO PAGES            | R-/R-  PTSIZE
  *    UPAGES    ---->  +------------------------------+ 0xef000000
- *                     |           RO ENVS            | R-/R-  PTSIZE
+ *                     |        RO Time Page          | R-/R-  PGSIZE
+ *    UTIME     ---->  +------------------------------+ 0xeefff000
+ *                     |           RO ENVS            | R-/R-  PTSIZE-PGSIZE
  * UTOP,UENVS ------>  +------------------------------+ 0xeec00000
  * UXSTACKTOP -/       |     User Exception Stack     | RW/RW  PGSIZE
  *                     +------------------------------+ 0xeebff000
@@ -112,8 +114,13 @@
 #define UVPT		(ULIM - PTSIZE)
 // Read-only copies of the Page structures
 #define UPAGES		(UVPT - PTSIZE)
-// Read-only copies of the global env structures
+// Read-only copies of the global env structures, which must fit in
+// UENVSIZE: the last page of the PTSIZE below UPAGES is UTIME's
 #define UENVS		(UPAGES - PTSIZE)
+#define UENVSIZE	(PTSIZE - PGSIZE)
+// Clock parameters for reading the time without a system call
+// (see inc/time.h)
+#define UTIME		(UENVS + UENVSIZE)
 
 /*
  * Top of user VM. User can manipulate VA from UTOP-1 and down!
@@ -143,5 +150,40 @@
 typedef uint32_t pte_t;
 typedef uint32_t pde_t;
 
+/*
+ * Page descriptor structures, mapped at UPAGES.
+ * Read/write to the kernel, read-only to user programs.
+ *
+ * Each struct PageInfo stores metadata for one physical page.
+ * Is it NOT the physical page itself, but there is a one-to-one
+ * correspondence between physical pages and struct PageInfo's.
+ * You can map a struct PageInfo * to the corresponding physical address
+ * with page2pa() in kern/pmap.h.
+ *
+ * Free memory is kept in buddy blocks of 2^order pages (see
+ * kern/pmap.c); only the first page of a free block is on a free list.
+ */
+struct PageInfo {
+	// Next block on the free list.
+	struct PageInfo *pp_link;
+	// The pointer that points to this block on the free list, so
+	// that a block can be unlinked when it merges with its buddy.
+	struct PageInfo **pp_pprev;
+
+	// pp_ref is the count of pointers (usually in page table entries)
+	// to this page, for pages allocated using page_alloc.
+	// Pages allocated at boot time using pmap.c's
+	// boot_alloc do not have valid reference count fields.
+
+	uint16_t pp_ref;
+
+	// The order of the free block this page heads, PP_CACHED if the
+	// page is free in a per-CPU page cache, or PP_NOTFREE.
+	uint8_t pp_order;
+};
+
+#define PP_CACHED	0xFE
+#define PP_NOTFREE	0xFF
+
 #endif /* !__ASSEMBLER__ */
 #endif /* !JOS_INC_MEMLAYOUT_H */
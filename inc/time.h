@@ -0,0 +1,55 @@
+#ifndef JOS_INC_TIME_H
+#define JOS_INC_TIME_H
+
+#include <inc/types.h>
+#include <inc/x86.h>
+
+/*
+ * The kernel's clock, published read-only at UTIME so that user code
+ * can tell the time without a system call:
+ *
+ *	ns = tp_ns_base + (rdtsc - tp_tsc_base) * tp_mult >> tp_shift
+ *
+ * The kernel makes tp_seq odd while it rewrites the other fields, so
+ * readers retry if tp_seq was odd or changed while they read them.
+ */
+struct TimePage {
+	volatile uint32_t tp_seq;
+	uint32_t tp_mult;
+	uint32_t tp_shift;
+	uint64_t tp_tsc_base;
+	uint64_t tp_ns_base;
+	uint64_t tp_tsc_hz;
+};
+
+// (delta * mult) >> shift, for shift <= 32, keeping all 96 bits of the
+// product so that it doesn't overflow a few seconds in.
+static inline uint64_t
+time_tsc2ns(uint64_t delta, uint32_t mult, uint32_t shift)
+{
+	uint64_t lo = (uint64_t) (uint32_t) delta * mult;
+	uint64_t hi = (delta >> 32) * mult;
+
+	return (hi << (32 - shift)) + (lo >> shift);
+}
+
+// Nanoseconds since the kernel started its clock.
+static inline uint64_t
+timepage_ns(const struct TimePage *tp)
+{
+	uint32_t seq;
+	uint64_t ns;
+
+	do {
+		while ((seq = tp->tp_seq) & 1)
+			/* do nothing */;
+		asm volatile("" : : : "memory");
+		ns = tp->tp_ns_base
+			+ time_tsc2ns(read_tsc() - tp->tp_tsc_base,
+				      tp->tp_mult, tp->tp_shift);
+		asm volatile("" : : : "memory");
+	} while (tp->tp_seq != seq);
+	return ns;
+}
+
+#endif /* !JOS_INC_TIME_H */
@@ -248,6 +248,14 @@ read_tsc(void)
 	return tsc;
 }
 
+// Spin-wait hint: lets a sibling hyperthread (or, under a hypervisor,
+// another guest) have the core.
+static inline void
+pause(void)
+{
+	asm volatile("pause");
+}
+
 static inline uint32_t
 xchg(volatile uint32_t *addr, uint32_t newval)
 {
@@ -0,0 +1,76 @@
+// Picking up the record the boot loader left in low memory.
+
+#include <inc/x86.h>
+#include <inc/memlayout.h>
+
+#include <kern/bootinfo.h>
+
+#define MULTIBOOT_BOOTLOADER_MAGIC	0x2BADB002
+#define MULTIBOOT_INFO_MEM_MAP		0x40	// mmap_* fields are valid
+
+// The part of the multiboot information structure that we use.
+struct MultibootInfo {
+	uint32_t mi_flags;
+	uint32_t mi_unused[10];
+	uint32_t mi_mmap_length;	// bytes of memory map
+	uint32_t mi_mmap_addr;		// physical address of memory map
+};
+
+struct Bootinfo bootinfo;
+
+// Saved by entry.S.
+extern uint32_t multiboot_magic, multiboot_info;
+
+// Build bootinfo's memory map from the one a multiboot loader gave us.
+// Each entry is preceded by its size, not counting the size itself.
+static void
+bootinfo_multiboot(void)
+{
+	struct MultibootInfo *mi;
+	uint32_t pa, end, n;
+
+	// Only the first 4MB of physical memory is mapped yet.
+	if (multiboot_info + sizeof(*mi) > PTSIZE)
+		return;
+	mi = (struct MultibootInfo *) (KERNBASE + multiboot_info);
+	if (!(mi->mi_flags & MULTIBOOT_INFO_MEM_MAP))
+		return;
+
+	pa = mi->mi_mmap_addr;
+	end = MIN(pa + mi->mi_mmap_length, PTSIZE);
+	for (n = 0; n < MMAP_MAX && pa + 4 + MMAP_ENTSIZE <= end; n++) {
+		bootinfo.bi_mmap[n] = *(struct Mmap *) (KERNBASE + pa + 4);
+		pa += 4 + *(uint32_t *) (KERNBASE + pa);
+	}
+	bootinfo.bi_mmapend = BOOTINFO_MMAP + n * MMAP_ENTSIZE;
+}
+
+// Copy the loader's record out of low memory, which will be handed
+// out as ordinary pages later on.  Call once the BSS is clear.
+void
+bootinfo_init(void)
+{
+	struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO_PADDR);
+
+	if (bi->bi_magic == BOOTINFO_MAGIC)
+		bootinfo = *bi;
+	else if (multiboot_magic == MULTIBOOT_BOOTLOADER_MAGIC)
+		bootinfo_multiboot();
+}
+
+// Number of entries in bootinfo.bi_mmap; 0 if we have no memory map.
+int
+bootinfo_nmmap(void)
+{
+	if (bootinfo.bi_mmapend < BOOTINFO_MMAP)
+		return 0;
+	return MIN((bootinfo.bi_mmapend - BOOTINFO_MMAP) / MMAP_ENTSIZE,
+		   MMAP_MAX);
+}
+
+// Record that boot has reached timeline point 'phase' (BT_*).
+void
+boot_stamp(int phase)
+{
+	bootinfo.bi_tsc[phase] = read_tsc();
+}
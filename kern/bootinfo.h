@@ -0,0 +1,19 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_BOOTINFO_H
+#define JOS_KERN_BOOTINFO_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/boot.h>
+
+// The kernel's copy of the boot loader's record (see inc/boot.h).
+// bi_magic is 0 if we were not booted by boot/.
+extern struct Bootinfo bootinfo;
+
+void bootinfo_init(void);
+int bootinfo_nmmap(void);
+void boot_stamp(int phase);
+
+#endif /* !JOS_KERN_BOOTINFO_H */
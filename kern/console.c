@@ -7,6 +7,11 @@
 #include <inc/assert.h>
 
 #include <kern/console.h>
+#include <kern/pmap.h>
+#include <kern/timer.h>
+#include <kern/tsc.h>
+
+extern const char *panicstr;	// kern/init.c
 
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
@@ -473,13 +478,35 @@ cputchar(int c)
 	cons_putc(c);
 }
 
+// How long to wait between console polls while idle, in microseconds:
+// short next to the time between keystrokes and to a timer tick.  It
+// is timed rather than counted in pauses, since a pause takes anything
+// from a few cycles to over a hundred depending on the CPU.
+#define IDLE_BACKOFF_US	5
+
 int
 getchar(void)
 {
+	uint64_t end;
 	int c;
 
-	while ((c = cons_getc()) == 0)
-		/* do nothing */;
+	// Waiting for a key is the kernel's idle time.  Once there is no
+	// idle work left, poll less often: each poll is a handful of slow
+	// port reads, each of them a VM exit under a hypervisor.  After
+	// a panic, though, the timers and the page lists may be what is
+	// broken, so leave them alone and just wait for the monitor.
+	while ((c = cons_getc()) == 0) {
+		if (panicstr) {
+			pause();
+			continue;
+		}
+		timer_run();
+		if (!page_zero_idle()) {
+			end = read_tsc() + tsc_freq() * IDLE_BACKOFF_US / 1000000;
+			while (read_tsc() < end)
+				pause();
+		}
+	}
 	return c;
 }
 
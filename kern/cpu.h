@@ -0,0 +1,19 @@
+
+#ifndef JOS_INC_CPU_H
+#define JOS_INC_CPU_H
+
+#include <inc/types.h>
+
+// Maximum number of CPUs
+#define NCPU  8
+
+// Returns the current CPU's number.  Only the boot CPU (CPU 0) runs
+// until the other CPUs are started through the local APIC, and then
+// this will read its ID instead.
+static inline int
+cpunum(void)
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,65 @@
+// Block driver for the boot disk, on top of lib/ide.c.
+// Transfers go through the IDE controller's bus-master DMA engine when
+// there is one, so the CPU only sets them up instead of copying every
+// word through the data port.
+
+#include <inc/stdio.h>
+#include <inc/error.h>
+#include <inc/ide.h>
+
+#include <kern/disk.h>
+#include <kern/pmap.h>
+
+// Aligned to its own size so that it can't cross a 64KB boundary.
+static struct IdePrd disk_prdt[IDE_NPRD] __attribute__((aligned(sizeof(struct IdePrd) * IDE_NPRD)));
+static bool disk_dma;
+
+void
+disk_init(void)
+{
+	disk_dma = ide_dma_init(disk_prdt, PADDR(disk_prdt));
+	if (!disk_dma)
+		cprintf("disk: no bus-master IDE controller, using PIO\n");
+}
+
+bool
+disk_has_dma(void)
+{
+	return disk_dma;
+}
+
+// Move 'nsecs' sectors between sector 'secno' and the kernel buffer
+// 'va', which must be physically contiguous (anything above KERNBASE
+// is).
+static int
+disk_rw(uint32_t secno, void *va, size_t nsecs, bool write)
+{
+	size_t n;
+	int r;
+
+	for (; nsecs > 0; nsecs -= n, secno += n, va += n * SECTSIZE) {
+		n = MIN(nsecs, IDE_MAXSECT);
+		if (disk_dma) {
+			if ((r = ide_dma_start(secno, PADDR(va), n, write)) == 0)
+				r = ide_dma_wait();
+		} else if (write)
+			r = ide_pio_write(secno, va, n);
+		else
+			r = ide_pio_read(secno, va, n);
+		if (r < 0)
+			return r;
+	}
+	return 0;
+}
+
+int
+disk_read(uint32_t secno, void *dst, size_t nsecs)
+{
+	return disk_rw(secno, dst, nsecs, 0);
+}
+
+int
+disk_write(uint32_t secno, const void *src, size_t nsecs)
+{
+	return disk_rw(secno, (void *) src, nsecs, 1);
+}
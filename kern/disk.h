@@ -0,0 +1,16 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_DISK_H
+#define JOS_KERN_DISK_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+void disk_init(void);
+bool disk_has_dma(void);
+int disk_read(uint32_t secno, void *dst, size_t nsecs);
+int disk_write(uint32_t secno, const void *src, size_t nsecs);
+
+#endif /* !JOS_KERN_DISK_H */
@@ -0,0 +1,185 @@
+// Lazy switching of the floating-point unit.
+//
+// The x87/MMX/SSE registers take 512 bytes to save, and most contexts
+// never touch them, so they are not switched along with everything
+// else.  fpu_switch only sets CR0_TS; the new context's first FPU
+// instruction then faults with #NM (device not available), and only
+// then does fpu_trap save the registers of whichever context last used
+// the FPU on this CPU and load the new context's.  A context that never
+// uses the FPU costs nothing, and one that runs again before anyone
+// else uses the FPU finds its registers still loaded.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/assert.h>
+
+#include <kern/fpu.h>
+#include <kern/cpu.h>
+
+#define CPUID_FXSR	(1 << 24)	// CPUID leaf 1, %edx
+#define CPUID_SSE	(1 << 25)
+
+#define FCW_DEFAULT	0x037F		// x87 control word after FNINIT
+
+struct FpuCpu {
+	struct FpuState *fc_current;	// context running on this CPU
+	struct FpuState *fc_owner;	// context whose registers are loaded
+	uint32_t fc_loads;		// owner changes
+};
+
+static struct FpuCpu fpu_cpus[NCPU];
+static struct FpuState fpu_initstate;	// registers for a context's first use
+static bool fpu_fxsr;
+
+static void check_fpu(void);
+
+static void
+fpu_save(struct FpuState *fs)
+{
+	if (fpu_fxsr)
+		asm volatile("fxsave %0" : "=m" (fs->fs_regs));
+	else
+		asm volatile("fnsave %0; fwait" : "=m" (fs->fs_regs));
+}
+
+static void
+fpu_restore(struct FpuState *fs)
+{
+	if (fpu_fxsr)
+		asm volatile("fxrstor %0" : : "m" (fs->fs_regs));
+	else
+		asm volatile("frstor %0" : : "m" (fs->fs_regs));
+}
+
+void
+fpu_init(void)
+{
+	uint32_t edx, cr4;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	fpu_fxsr = (edx & CPUID_FXSR) != 0;
+
+	// Use the FPU natively (no EM), report its errors as exceptions
+	// (NE), and have WAIT honor TS too (MP).
+	lcr0((rcr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+	if (fpu_fxsr) {
+		cr4 = rcr4() | CR4_OSFXSR;
+		if (edx & CPUID_SSE)
+			cr4 |= CR4_OSXMMEXCPT;
+		lcr4(cr4);
+	}
+	asm volatile("fninit");
+	fpu_save(&fpu_initstate);
+
+	check_fpu();
+}
+
+//
+// Switch this CPU to the context whose FPU registers live in 'next'.
+// Call this on every context switch.  Nothing is saved or loaded
+// here: if 'next' doesn't have its registers loaded already, its
+// first FPU instruction will trap to fpu_trap.
+//
+void
+fpu_switch(struct FpuState *next)
+{
+	struct FpuCpu *fc = &fpu_cpus[cpunum()];
+
+	fc->fc_current = next;
+	if (next == fc->fc_owner)
+		asm volatile("clts");
+	else
+		lcr0(rcr0() | CR0_TS);
+}
+
+//
+// Handle #NM: the running context wants the FPU, so hand it over.
+//
+void
+fpu_trap(void)
+{
+	struct FpuCpu *fc = &fpu_cpus[cpunum()];
+	struct FpuState *cur = fc->fc_current;
+
+	if (!cur)
+		panic("FPU used with no context to charge it to");
+
+	asm volatile("clts");
+	if (fc->fc_owner == cur)
+		return;
+	if (fc->fc_owner)
+		fpu_save(fc->fc_owner);
+	fpu_restore(cur->fs_used ? cur : &fpu_initstate);
+	cur->fs_used = true;
+	fc->fc_owner = cur;
+	fc->fc_loads++;
+}
+
+//
+// Forget 'fs', which is about to be freed, so that its registers are
+// never saved into it.
+//
+void
+fpu_release(struct FpuState *fs)
+{
+	int i;
+
+	for (i = 0; i < NCPU; i++) {
+		if (fpu_cpus[i].fc_owner == fs)
+			fpu_cpus[i].fc_owner = NULL;
+		if (fpu_cpus[i].fc_current == fs)
+			fpu_cpus[i].fc_current = NULL;
+	}
+}
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+//
+// There is no IDT to deliver #NM yet, so call fpu_trap wherever
+// the context's first FPU instruction would have trapped.
+//
+static void
+check_fpu(void)
+{
+	static struct FpuState a, b, c;
+	struct FpuCpu *fc = &fpu_cpus[cpunum()];
+	uint32_t loads = fc->fc_loads;
+	uint16_t cw;
+
+	// a changes the control word
+	fpu_switch(&a);
+	assert(rcr0() & CR0_TS);
+	fpu_trap();
+	assert(!(rcr0() & CR0_TS) && fc->fc_owner == &a);
+	cw = 0x027F;
+	asm volatile("fldcw %0" : : "m" (cw));
+
+	// b starts out with clean registers
+	fpu_switch(&b);
+	assert(rcr0() & CR0_TS);
+	fpu_trap();
+	asm volatile("fnstcw %0" : "=m" (cw));
+	assert(cw == FCW_DEFAULT && fc->fc_owner == &b);
+
+	// c never uses the FPU, so b gets its registers back for free
+	fpu_switch(&c);
+	fpu_switch(&b);
+	assert(!(rcr0() & CR0_TS));
+	assert(fc->fc_loads == loads + 2 && !c.fs_used);
+
+	// a gets its own control word back
+	fpu_switch(&a);
+	fpu_trap();
+	asm volatile("fnstcw %0" : "=m" (cw));
+	assert(cw == 0x027F && fc->fc_loads == loads + 3);
+
+	asm volatile("fninit");
+	fpu_release(&a);
+	fpu_release(&b);
+	fpu_switch(NULL);
+	assert(!(rcr0() & CR0_TS));
+
+	cprintf("check_fpu() succeeded!\n");
+}
@@ -0,0 +1,23 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FPU_H
+#define JOS_KERN_FPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Saved x87/MMX/SSE registers, in FXSAVE format (or FNSAVE format on
+// processors without FXSAVE).
+struct FpuState {
+	uint8_t fs_regs[512];
+	bool fs_used;			// ever touched the FPU
+} __attribute__((aligned(16)));
+
+void	fpu_init(void);
+void	fpu_switch(struct FpuState *next);
+void	fpu_trap(void);
+void	fpu_release(struct FpuState *fs);
+
+#endif /* !JOS_KERN_FPU_H */
@@ -3,9 +3,18 @@
 #include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/memlayout.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/disk.h>
+#include <kern/bootinfo.h>
+#include <kern/pmap.h>
+#include <kern/kmem.h>
+#include <kern/ipc.h>
+#include <kern/fpu.h>
+#include <kern/tsc.h>
+#include <kern/timer.h>
 
 // Test the stack backtrace function (lab 1 only)
 void
@@ -29,20 +38,45 @@ void
 i386_init(void)
 {
 	extern char edata[], end[];
+	struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO_PADDR);
 
 	// Before doing anything else, complete the ELF loading process.
-	// Clear the uninitialized global data (BSS) section of our program.
+	// Clear the uninitialized global data (BSS) section of our program,
+	// unless the boot loader already did so while loading us.
 	// This ensures that all static/global variables start out zero.
-	memset(edata, 0, end - edata);
+	if (bi->bi_magic != BOOTINFO_MAGIC || !(bi->bi_flags & BI_BSS_CLEAN))
+		memset(edata, 0, end - edata);
+
+	bootinfo_init();
+	boot_stamp(BT_I386_INIT);
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
+	boot_stamp(BT_CONS_INIT);
+
+	// Map all of physical memory at KERNBASE and set up the
+	// page and kernel object allocators.
+	mem_init();
+	boot_stamp(BT_MEM_INIT);
+	kmem_init();
+	boot_stamp(BT_KMEM_INIT);
+	ipc_init();
+	boot_stamp(BT_IPC_INIT);
+	fpu_init();
+	boot_stamp(BT_FPU_INIT);
+	tsc_init();
+	boot_stamp(BT_TSC_INIT);
+	timer_init();
+	boot_stamp(BT_TIMER_INIT);
+	disk_init();
+	boot_stamp(BT_DISK_INIT);
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
 	// Test the stack backtrace function (lab 1 only)
 	test_backtrace(5);
+	boot_stamp(BT_BACKTRACE);
 
 	// Drop into the kernel monitor.
 	while (1)
@@ -0,0 +1,295 @@
+// Inter-address-space communication.
+//
+// ipc_map_pages moves any amount of page-aligned data from one address
+// space to another in one go, without copying it: the sender names
+// its pages as a list of runs, and they are mapped, in order, into a
+// window the receiver has set aside.
+//
+// For streams of small messages, ipc_ring_create sets up a ring
+// (inc/ipcring.h) in memory shared by two address spaces, through
+// which the two sides talk without entering the kernel at all.
+
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/ipcring.h>
+
+#include <kern/ipc.h>
+#include <kern/pmap.h>
+
+#define IPC_BATCH	32	// mappings handed to page_map_batch at once
+
+static void check_ipc_pages(void);
+static void check_ipc_ring(void);
+
+void
+ipc_init(void)
+{
+	check_ipc_pages();
+	check_ipc_ring();
+}
+
+//
+// Map the pages of the 'nseg' runs in 'segs', in 'src', one after the
+// other into the window of 'dstnpages' pages at 'dstva' in 'dst', with
+// permissions 'perm' (as for page_map_batch).  Pages already mapped in
+// the window are replaced; the rest of the window is left alone.
+//
+// RETURNS:
+//   the number of pages mapped, on success
+//   -E_INVAL if a run isn't page-aligned and below UTOP, if the pages
+//	don't fit in the window, or if any page can't be mapped with
+//	'perm' (in which case nothing is mapped)
+//   -E_NO_MEM if a page table couldn't be allocated (in which case
+//	some of the pages may have been mapped)
+// Only running out of memory can stop it part way.
+//
+int
+ipc_map_pages(pde_t *src, const struct IpcSeg *segs, int nseg,
+	      pde_t *dst, void *dstva, size_t dstnpages, int perm)
+{
+	struct PageMapOp ops[IPC_BATCH];
+	struct PageInfo *pp;
+	size_t total = 0, i;
+	char *srcva;
+	int s, n, r;
+
+	if (PGOFF(dstva) || (uintptr_t) dstva >= UTOP
+	    || dstnpages > (UTOP - (uintptr_t) dstva) / PGSIZE)
+		return -E_INVAL;
+
+	// Check everything first, so that bad input maps nothing.  This
+	// is the same check page_map_batch makes, so it won't find any
+	// more bad entries.
+	for (s = 0; s < nseg; s++) {
+		srcva = segs[s].sg_va;
+		if (PGOFF(srcva) || (uintptr_t) srcva >= UTOP
+		    || segs[s].sg_npages > (UTOP - (uintptr_t) srcva) / PGSIZE)
+			return -E_INVAL;
+		total += segs[s].sg_npages;
+		if (total > dstnpages)
+			return -E_INVAL;
+		for (i = 0; i < segs[s].sg_npages; i++, srcva += PGSIZE)
+			if ((r = page_map_check(src, srcva, perm, &pp)) < 0)
+				return r;
+	}
+
+	// Then map the pages in batches, with one TLB flush per batch.
+	n = 0;
+	for (s = 0; s < nseg; s++) {
+		srcva = segs[s].sg_va;
+		for (i = 0; i < segs[s].sg_npages; i++, srcva += PGSIZE) {
+			ops[n].pm_srcva = srcva;
+			ops[n].pm_dstpgdir = dst;
+			ops[n].pm_dstva = dstva;
+			ops[n].pm_perm = perm;
+			dstva += PGSIZE;
+			if (++n == IPC_BATCH) {
+				if (page_map_batch(src, ops, n) != n)
+					return -E_NO_MEM;
+				n = 0;
+			}
+		}
+	}
+	if (n > 0 && page_map_batch(src, ops, n) != n)
+		return -E_NO_MEM;
+	return total;
+}
+
+//
+// Make a message ring with 2^order pages of slots and map it at 'va_a'
+// in 'pgdir_a' and at 'va_b' in 'pgdir_b', writable in both.  The
+// slots come first, then one more page for the struct IpcRing.  Pages
+// already mapped there are replaced.
+//
+// RETURNS:
+//   the number of slots, for ipcring_attach, on success
+//   -E_INVAL if 'va_a' or 'va_b' isn't page-aligned, or the ring
+//	wouldn't fit below UTOP, or 'order' is too big
+//   -E_NO_MEM if out of memory (in which case nothing is mapped)
+//
+int
+ipc_ring_create(pde_t *pgdir_a, void *va_a, pde_t *pgdir_b, void *va_b,
+		int order)
+{
+	struct PageInfo *pp, *hp;
+	size_t size, npages, i;
+
+	if (order < 0 || order > MAX_ORDER)
+		return -E_INVAL;
+	size = PGSIZE << order;
+	npages = (size >> PGSHIFT) + 1;
+	if (PGOFF(va_a) || (uintptr_t) va_a > UTOP - size - PGSIZE
+	    || PGOFF(va_b) || (uintptr_t) va_b > UTOP - size - PGSIZE)
+		return -E_INVAL;
+
+	if (!(pp = page_alloc_order(order, ALLOC_ZERO)))
+		return -E_NO_MEM;
+	if (!(hp = page_alloc(ALLOC_ZERO))) {
+		page_free_order(pp, order);
+		return -E_NO_MEM;
+	}
+
+	// Get all the page tables in place (and unshared) first, so
+	// that once mapping starts, page_insert can't fail.
+	for (i = 0; i < npages; i++)
+		if (!pgdir_walk(pgdir_a, va_a + i * PGSIZE, 1)
+		    || !pgdir_walk(pgdir_b, va_b + i * PGSIZE, 1)) {
+			page_free_order(pp, order);
+			page_free(hp);
+			return -E_NO_MEM;
+		}
+
+	for (i = 0; i < npages; i++) {
+		struct PageInfo *p = i < npages - 1 ? &pp[i] : hp;
+		if (page_insert(pgdir_a, p, va_a + i * PGSIZE, PTE_U | PTE_W) < 0
+		    || page_insert(pgdir_b, p, va_b + i * PGSIZE,
+				   PTE_U | PTE_W) < 0)
+			panic("ipc_ring_create: page_insert failed");
+	}
+	return size / IPCRING_MSGSIZE;
+}
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+static pde_t *
+check_pgdir_alloc(void)
+{
+	struct PageInfo *pp;
+
+	assert((pp = page_alloc(ALLOC_ZERO)));
+	pp->pp_ref++;
+	return page2kva(pp);
+}
+
+static void
+check_ipc_pages(void)
+{
+	struct PageInfo *pp[40];
+	struct IpcSeg segs[2];
+	pde_t *src, *dst, *child;
+	char *va = (char *) UTEXT, *win = (char *) (UTEXT + PTSIZE);
+	pte_t *pte;
+	int i;
+
+	src = check_pgdir_alloc();
+	dst = check_pgdir_alloc();
+	for (i = 0; i < 40; i++) {
+		assert((pp[i] = page_alloc(0)));
+		assert(page_insert(src, pp[i], va + i * PGSIZE,
+				   PTE_U | (i == 39 ? 0 : PTE_W)) == 0);
+	}
+
+	// 16 pages and then 20 more, after a gap, into a 40-page window
+	segs[0].sg_va = va;
+	segs[0].sg_npages = 16;
+	segs[1].sg_va = va + 18 * PGSIZE;
+	segs[1].sg_npages = 20;
+	assert(ipc_map_pages(src, segs, 2, dst, win, 40,
+			     PTE_U | PTE_P | PTE_W) == 36);
+	for (i = 0; i < 36; i++) {
+		assert(page_lookup(dst, win + i * PGSIZE, &pte)
+		       == pp[i < 16 ? i : i + 2]);
+		assert(*pte & PTE_W);
+	}
+	assert(!page_lookup(dst, win + 36 * PGSIZE, 0));
+
+	// too big for the window, or not writable: nothing happens
+	assert(ipc_map_pages(src, segs, 2, dst, win + PTSIZE, 35,
+			     PTE_U | PTE_P) == -E_INVAL);
+	segs[1].sg_npages = 22;
+	assert(ipc_map_pages(src, segs, 2, dst, win + PTSIZE, 40,
+			     PTE_U | PTE_P | PTE_W) == -E_INVAL);
+	segs[1].sg_npages = 20;
+	assert(ipc_map_pages(src, segs, 2, dst, win + PTSIZE, 40,
+			     PTE_P | PTE_W) == -E_INVAL);
+	assert(!page_lookup(dst, win + PTSIZE, 0));
+
+	// once the sender has forked, its pages are copy-on-write and
+	// can only be passed on read-only
+	child = check_pgdir_alloc();
+	assert(pgdir_copy_cow(child, src) == 0);
+	assert(ipc_map_pages(src, segs, 2, dst, win + PTSIZE, 40,
+			     PTE_U | PTE_P | PTE_W) == -E_INVAL);
+	assert(!page_lookup(dst, win + PTSIZE, 0));
+	assert(ipc_map_pages(src, segs, 2, dst, win + PTSIZE, 40,
+			     PTE_U | PTE_P) == 36);
+	pgdir_destroy(child);
+
+	pgdir_destroy(dst);
+	pgdir_destroy(src);
+	for (i = 0; i < 40; i++)
+		assert(pp[i]->pp_ref == 0);
+
+	cprintf("check_ipc_pages() succeeded!\n");
+}
+
+static void
+check_ipc_ring(void)
+{
+	struct IpcRingEnd prod, cons;
+	pde_t *a, *b;
+	char *va_a = (char *) UTEXT, *va_b = (char *) (UTEXT + PTSIZE);
+	char buf[IPCRING_MAXLEN];
+	struct IpcMsg *m;
+	bool wake;
+	uint32_t i, n;
+	int r;
+
+	a = check_pgdir_alloc();
+	b = check_pgdir_alloc();
+	assert(ipc_ring_create(a, va_a + 1, b, va_b, 0) == -E_INVAL);
+	assert(ipc_ring_create(a, (void *) (UTOP - 2 * PGSIZE), b, va_b, 1)
+	       == -E_INVAL);
+	assert((r = ipc_ring_create(a, va_a, b, va_b, 1)) > 0);
+
+	// The slots fill the pages, and both sides see the same memory.
+	n = r;
+	assert(n * IPCRING_MSGSIZE == 2 * PGSIZE);
+	for (i = 0; i < 3; i++)
+		assert(page_lookup(a, va_a + i * PGSIZE, 0)
+		       == page_lookup(b, va_b + i * PGSIZE, 0));
+	assert(page_lookup(a, va_a + PGSIZE, 0)
+	       == page_lookup(a, va_a, 0) + 1);
+
+	// The slot pages are contiguous in kernel memory too, but the
+	// header page isn't.
+	ipcring_attach(&prod, page2kva(page_lookup(a, va_a, 0)), n);
+	ipcring_attach(&cons, page2kva(page_lookup(b, va_b, 0)), n);
+	prod.e_ring = cons.e_ring = page2kva(page_lookup(a, va_a + 2 * PGSIZE, 0));
+
+	// fill it up, wrapping around, then drain it
+	assert(ipcring_get(&cons, buf, &wake) == -1);
+	for (i = 0; i < n / 2; i++) {
+		assert(ipcring_put(&prod, &i, sizeof(i), &wake) && !wake);
+		assert(ipcring_get(&cons, buf, &wake) == sizeof(i) && !wake);
+	}
+	for (i = 0; i < n; i++)
+		assert(ipcring_put(&prod, &i, sizeof(i), &wake));
+	assert(!ipcring_put(&prod, &i, sizeof(i), &wake));
+	for (i = 0; i < n; i++) {
+		assert(ipcring_get(&cons, buf, &wake) == sizeof(i));
+		assert(*(uint32_t *) buf == i);
+	}
+
+	// a message claiming to be too long is dropped, not copied
+	assert(ipcring_put(&prod, "x", 2, &wake));
+	m = &prod.e_slots[(prod.e_ring->r_head - 1) & (n - 1)];
+	m->m_len = 0x10000;
+	assert(ipcring_get(&cons, buf, &wake) == -E_INVAL);
+	assert(ipcring_get(&cons, buf, &wake) == -1);
+
+	// a sleeping consumer gets woken up by the next message
+	assert(ipcring_prepare_wait(&cons, false));
+	assert(ipcring_put(&prod, "hi", 3, &wake) && wake);
+	ipcring_wait_done(&cons, false);
+	assert(!ipcring_prepare_wait(&cons, false));
+	assert(ipcring_get(&cons, buf, &wake) == 3 && strcmp(buf, "hi") == 0);
+
+	pgdir_destroy(a);
+	pgdir_destroy(b);
+
+	cprintf("check_ipc_ring() succeeded!\n");
+}
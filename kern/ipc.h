@@ -0,0 +1,24 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_IPC_H
+#define JOS_KERN_IPC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+
+// A run of 'sg_npages' pages starting at 'sg_va', for ipc_map_pages.
+struct IpcSeg {
+	void *sg_va;
+	size_t sg_npages;
+};
+
+void	ipc_init(void);
+int	ipc_map_pages(pde_t *src, const struct IpcSeg *segs, int nseg,
+		      pde_t *dst, void *dstva, size_t dstnpages, int perm);
+int	ipc_ring_create(pde_t *pgdir_a, void *va_a, pde_t *pgdir_b,
+			void *va_b, int order);
+
+#endif /* !JOS_KERN_IPC_H */
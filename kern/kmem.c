@@ -0,0 +1,413 @@
+// Slab allocator for fixed-size kernel objects, after Bonwick,
+// "The Slab Allocator: An Object-Caching Kernel Memory Allocator".
+//
+// Each cache carves blocks of 2^kc_order pages from the page allocator
+// into slabs of equally sized objects.  A slab starts with its header
+// and an array of free object indices, followed by the objects.  Each
+// object is aligned to a cache line, or to a power of two at least its
+// size if it is smaller, so that no object straddles more cache lines
+// than it has to.
+//
+// Objects are kept in their constructed state: a cache's constructor
+// runs on every object of a new slab, and callers must hand objects
+// back to kmem_cache_free in the same state.
+//
+// In front of the slabs, each CPU keeps a small stack of free objects
+// per cache, so that most allocations and frees just pop or push one.
+
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/kmem.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+
+#define KMEM_CPU_LIMIT	16	// objects in a per-CPU stack
+#define KMEM_CPU_BATCH	8	// objects moved to or from slabs at a time
+#define KMEM_MIN_OBJS	8	// objects a slab should hold
+#define KMEM_MAX_ORDER	3	// largest slab is 2^KMEM_MAX_ORDER pages
+
+#define SLAB_END	0xFFFF	// end of a slab's free index list
+
+struct Slab {
+	struct Slab *sl_link;		// next slab on the same list
+	struct Slab **sl_pprev;		// pointer to this slab on its list
+	char *sl_objs;			// first object
+	uint16_t sl_inuse;		// objects allocated from this slab
+	uint16_t sl_free;		// first free object, or SLAB_END
+	uint16_t sl_next[];		// for each free object, the next one
+};
+
+struct KmemCpuCache {
+	int cc_avail;			// objects in cc_objs
+	void *cc_objs[KMEM_CPU_LIMIT];	// most recently freed last
+};
+
+struct KmemCache {
+	char kc_name[16];
+	size_t kc_size;			// object size, padded to alignment
+	size_t kc_objoff;		// offset of the first object in a slab
+	void (*kc_ctor)(void *);
+	int kc_order;			// a slab is 2^kc_order pages
+	int kc_perslab;			// objects per slab
+
+	// Slabs with no free objects, some, and all of them.
+	struct Slab *kc_full, *kc_partial, *kc_empty;
+	uint32_t kc_nslabs;
+	uint32_t kc_inslabs;		// objects allocated from slabs
+	uint32_t kc_allocs;		// kmem_cache_alloc calls
+	uint32_t kc_cpuhits;		// of which served by a per-CPU stack
+
+	struct KmemCpuCache kc_cpu[NCPU];
+	struct KmemCache *kc_link;	// next on kmem_caches
+};
+
+// Caches are themselves allocated from this one.
+static struct KmemCache kmem_cache_cache;
+static struct KmemCache *kmem_caches;
+
+static void check_kmem(void);
+
+// --------------------------------------------------------------
+// Slabs.
+// --------------------------------------------------------------
+
+static void
+slab_insert(struct Slab **list, struct Slab *sl)
+{
+	sl->sl_link = *list;
+	if (sl->sl_link)
+		sl->sl_link->sl_pprev = &sl->sl_link;
+	sl->sl_pprev = list;
+	*list = sl;
+}
+
+static void
+slab_remove(struct Slab *sl)
+{
+	*sl->sl_pprev = sl->sl_link;
+	if (sl->sl_link)
+		sl->sl_link->sl_pprev = sl->sl_pprev;
+}
+
+// Move 'sl' to the cache's list that matches how full it is.
+static void
+slab_relist(struct KmemCache *cp, struct Slab *sl)
+{
+	slab_remove(sl);
+	if (sl->sl_inuse == cp->kc_perslab)
+		slab_insert(&cp->kc_full, sl);
+	else if (sl->sl_inuse > 0)
+		slab_insert(&cp->kc_partial, sl);
+	else
+		slab_insert(&cp->kc_empty, sl);
+}
+
+// Get a new slab from the page allocator and construct its objects.
+static struct Slab *
+slab_create(struct KmemCache *cp)
+{
+	struct PageInfo *pp;
+	struct Slab *sl;
+	int i;
+
+	if (!(pp = page_alloc_order(cp->kc_order, 0)))
+		return NULL;
+	pp->pp_ref++;
+
+	sl = page2kva(pp);
+	sl->sl_objs = (char *) sl + cp->kc_objoff;
+	sl->sl_inuse = 0;
+	sl->sl_free = 0;
+	for (i = 0; i < cp->kc_perslab; i++) {
+		sl->sl_next[i] = i + 1 < cp->kc_perslab ? i + 1 : SLAB_END;
+		if (cp->kc_ctor)
+			cp->kc_ctor(sl->sl_objs + i * cp->kc_size);
+	}
+	slab_insert(&cp->kc_empty, sl);
+	cp->kc_nslabs++;
+	return sl;
+}
+
+static void
+slab_destroy(struct KmemCache *cp, struct Slab *sl)
+{
+	struct PageInfo *pp = pa2page(PADDR(sl));
+
+	slab_remove(sl);
+	cp->kc_nslabs--;
+	pp->pp_ref--;
+	page_free_order(pp, cp->kc_order);
+}
+
+static void *
+slab_alloc(struct KmemCache *cp)
+{
+	struct Slab *sl;
+	int i;
+
+	if (!(sl = cp->kc_partial) && !(sl = cp->kc_empty)
+	    && !(sl = slab_create(cp)))
+		return NULL;
+
+	i = sl->sl_free;
+	sl->sl_free = sl->sl_next[i];
+	sl->sl_inuse++;
+	cp->kc_inslabs++;
+	slab_relist(cp, sl);
+	return sl->sl_objs + i * cp->kc_size;
+}
+
+static void
+slab_free(struct KmemCache *cp, void *obj)
+{
+	struct Slab *sl;
+	size_t i;
+
+	// Slabs are aligned to their size, so the header is easy to find.
+	sl = ROUNDDOWN(obj, PGSIZE << cp->kc_order);
+	i = ((char *) obj - sl->sl_objs) / cp->kc_size;
+	if ((char *) obj < sl->sl_objs || i >= cp->kc_perslab
+	    || sl->sl_objs + i * cp->kc_size != obj)
+		panic("kmem_cache_free: %p is not a %s", obj, cp->kc_name);
+
+	sl->sl_next[i] = sl->sl_free;
+	sl->sl_free = i;
+	sl->sl_inuse--;
+	cp->kc_inslabs--;
+
+	// Keep one empty slab around; give the rest back.
+	if (sl->sl_inuse == 0 && cp->kc_empty)
+		slab_destroy(cp, sl);
+	else
+		slab_relist(cp, sl);
+}
+
+// Return every object in the per-CPU stacks to its slab.
+static void
+kmem_cache_drain(struct KmemCache *cp)
+{
+	struct KmemCpuCache *cc;
+	int i;
+
+	for (i = 0; i < NCPU; i++) {
+		cc = &cp->kc_cpu[i];
+		while (cc->cc_avail > 0)
+			slab_free(cp, cc->cc_objs[--cc->cc_avail]);
+	}
+}
+
+// --------------------------------------------------------------
+// Caches.
+// --------------------------------------------------------------
+
+static int
+kmem_cache_setup(struct KmemCache *cp, const char *name, size_t size,
+		 size_t align, void (*ctor)(void *))
+{
+	size_t slabsize, n;
+
+	if (size == 0 || (align & (align - 1)))
+		return -1;
+	if (align == 0) {
+		if (size >= CACHE_LINE_SIZE)
+			align = CACHE_LINE_SIZE;
+		else
+			for (align = sizeof(void *); align < size; align <<= 1)
+				/* do nothing */;
+	}
+
+	memset(cp, 0, sizeof(*cp));
+	strncpy(cp->kc_name, name, sizeof(cp->kc_name) - 1);
+	cp->kc_size = ROUNDUP(size, align);
+	cp->kc_ctor = ctor;
+
+	// Use the smallest slab that holds KMEM_MIN_OBJS objects.
+	for (cp->kc_order = 0; ; cp->kc_order++) {
+		slabsize = PGSIZE << cp->kc_order;
+		n = (slabsize - sizeof(struct Slab))
+			/ (cp->kc_size + sizeof(uint16_t));
+		while (n > 0 && ROUNDUP(sizeof(struct Slab)
+					+ n * sizeof(uint16_t), align)
+			       + n * cp->kc_size > slabsize)
+			n--;
+		if (n >= KMEM_MIN_OBJS || cp->kc_order == KMEM_MAX_ORDER)
+			break;
+	}
+	if (n == 0)
+		return -1;
+	cp->kc_perslab = n;
+	cp->kc_objoff = ROUNDUP(sizeof(struct Slab) + n * sizeof(uint16_t),
+				align);
+
+	cp->kc_link = kmem_caches;
+	kmem_caches = cp;
+	return 0;
+}
+
+//
+// Create a cache of objects of 'size' bytes, aligned to 'align' bytes
+// (0 means to a cache line).  'ctor', if not NULL, is called on each
+// object when it is first put in the cache.
+//
+// Returns NULL if out of memory or if the objects are too large.
+//
+struct KmemCache *
+kmem_cache_create(const char *name, size_t size, size_t align,
+		  void (*ctor)(void *))
+{
+	struct KmemCache *cp;
+
+	if (!(cp = kmem_cache_alloc(&kmem_cache_cache)))
+		return NULL;
+	if (kmem_cache_setup(cp, name, size, align, ctor) < 0) {
+		kmem_cache_free(&kmem_cache_cache, cp);
+		return NULL;
+	}
+	return cp;
+}
+
+//
+// Destroy a cache.  All of its objects must have been freed.
+//
+void
+kmem_cache_destroy(struct KmemCache *cp)
+{
+	struct KmemCache **pcp;
+
+	kmem_cache_drain(cp);
+	if (cp->kc_full || cp->kc_partial)
+		panic("kmem_cache_destroy: %s still has objects", cp->kc_name);
+	while (cp->kc_empty)
+		slab_destroy(cp, cp->kc_empty);
+
+	for (pcp = &kmem_caches; *pcp != cp; pcp = &(*pcp)->kc_link)
+		/* do nothing */;
+	*pcp = cp->kc_link;
+	kmem_cache_free(&kmem_cache_cache, cp);
+}
+
+//
+// Allocate an object from 'cp'.  Returns NULL if out of memory.
+//
+void *
+kmem_cache_alloc(struct KmemCache *cp)
+{
+	struct KmemCpuCache *cc = &cp->kc_cpu[cpunum()];
+	void *obj;
+
+	cp->kc_allocs++;
+	if (cc->cc_avail > 0)
+		cp->kc_cpuhits++;
+	else
+		while (cc->cc_avail < KMEM_CPU_BATCH
+		       && (obj = slab_alloc(cp)) != NULL)
+			cc->cc_objs[cc->cc_avail++] = obj;
+
+	if (cc->cc_avail == 0)
+		return NULL;
+	return cc->cc_objs[--cc->cc_avail];
+}
+
+//
+// Give 'obj' back to the cache it was allocated from.
+//
+void
+kmem_cache_free(struct KmemCache *cp, void *obj)
+{
+	struct KmemCpuCache *cc = &cp->kc_cpu[cpunum()];
+	int i;
+
+	// If the stack is full, return its oldest objects to their slabs.
+	if (cc->cc_avail == KMEM_CPU_LIMIT) {
+		for (i = 0; i < KMEM_CPU_BATCH; i++)
+			slab_free(cp, cc->cc_objs[i]);
+		memmove(cc->cc_objs, cc->cc_objs + KMEM_CPU_BATCH,
+			(KMEM_CPU_LIMIT - KMEM_CPU_BATCH) * sizeof(void *));
+		cc->cc_avail -= KMEM_CPU_BATCH;
+	}
+	cc->cc_objs[cc->cc_avail++] = obj;
+}
+
+// Print one line per cache, like Linux's /proc/slabinfo.
+void
+kmem_cache_stats(void)
+{
+	struct KmemCache *cp;
+	uint32_t active;
+	int i;
+
+	cprintf("%-15s %7s %7s %7s %5s %8s %5s %8s\n", "cache", "objsize",
+		"active", "total", "slabs", "obj/slab", "pages", "cpu hits");
+	for (cp = kmem_caches; cp; cp = cp->kc_link) {
+		active = cp->kc_inslabs;
+		for (i = 0; i < NCPU; i++)
+			active -= cp->kc_cpu[i].cc_avail;
+		cprintf("%-15s %7u %7u %7u %5u %8u %5u %7u%%\n", cp->kc_name,
+			cp->kc_size, active, cp->kc_nslabs * cp->kc_perslab,
+			cp->kc_nslabs, cp->kc_perslab, 1 << cp->kc_order,
+			cp->kc_allocs ? (uint32_t) ((uint64_t) cp->kc_cpuhits
+						    * 100 / cp->kc_allocs) : 0);
+	}
+}
+
+void
+kmem_init(void)
+{
+	if (kmem_cache_setup(&kmem_cache_cache, "kmem_cache",
+			     sizeof(struct KmemCache), 0, NULL) < 0)
+		panic("kmem_init: can't set up the cache of caches");
+	check_kmem();
+}
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+#define CHECK_MAGIC	0x6B6D656D	// "kmem"
+#define CHECK_NOBJS	200
+
+static void
+check_ctor(void *obj)
+{
+	memset(obj, 0, 100);
+	*(uint32_t *) obj = CHECK_MAGIC;
+}
+
+static void
+check_kmem(void)
+{
+	static char *objs[CHECK_NOBJS];
+	struct KmemCache *cp;
+	int i, j;
+
+	assert((cp = kmem_cache_create("check", 100, 0, check_ctor)));
+	assert(cp->kc_size == 128);
+	assert(cp->kc_perslab >= KMEM_MIN_OBJS);
+
+	// objects come constructed, aligned and distinct
+	for (i = 0; i < CHECK_NOBJS; i++) {
+		assert((objs[i] = kmem_cache_alloc(cp)));
+		assert((uintptr_t) objs[i] % CACHE_LINE_SIZE == 0);
+		assert(*(uint32_t *) objs[i] == CHECK_MAGIC);
+		for (j = 0; j < i; j++)
+			assert(objs[j] != objs[i]);
+	}
+	assert(cp->kc_nslabs * cp->kc_perslab >= CHECK_NOBJS);
+
+	// freed objects are reused, most recent first
+	kmem_cache_free(cp, objs[7]);
+	assert(kmem_cache_alloc(cp) == objs[7]);
+
+	// once everything is back, only one empty slab is kept
+	for (i = 0; i < CHECK_NOBJS; i++)
+		kmem_cache_free(cp, objs[i]);
+	kmem_cache_drain(cp);
+	assert(cp->kc_inslabs == 0);
+	assert(cp->kc_nslabs == 1 && cp->kc_empty && !cp->kc_partial);
+
+	kmem_cache_destroy(cp);
+	assert(kmem_caches == &kmem_cache_cache);
+
+	cprintf("check_kmem() succeeded!\n");
+}
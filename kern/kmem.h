@@ -0,0 +1,24 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KMEM_H
+#define JOS_KERN_KMEM_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#define CACHE_LINE_SIZE	64
+
+// A cache of equally sized kernel objects (see kern/kmem.c).
+struct KmemCache;
+
+void	kmem_init(void);
+struct KmemCache *kmem_cache_create(const char *name, size_t size,
+				    size_t align, void (*ctor)(void *));
+void	kmem_cache_destroy(struct KmemCache *cp);
+void	*kmem_cache_alloc(struct KmemCache *cp);
+void	kmem_cache_free(struct KmemCache *cp, void *obj);
+void	kmem_cache_stats(void);
+
+#endif /* !JOS_KERN_KMEM_H */
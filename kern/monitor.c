@@ -6,10 +6,16 @@
 #include <inc/memlayout.h>
 #include <inc/assert.h>
 #include <inc/x86.h>
+#include <inc/ide.h>
 
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/disk.h>
+#include <kern/bootinfo.h>
+#include <kern/tsc.h>
+#include <kern/pmap.h>
+#include <kern/kmem.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -24,7 +30,11 @@ struct Command {
 static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
-	{ "backtrace", "", mon_backtrace }
+	{ "backtrace", "", mon_backtrace },
+	{ "diskbench", "Time reading the disk by PIO and by DMA", mon_diskbench },
+	{ "boottime", "Display where boot time went", mon_boottime },
+	{ "pagecache", "Display per-CPU page cache statistics", mon_pagecache },
+	{ "slabinfo", "Display kernel object cache statistics", mon_slabinfo }
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -110,6 +120,106 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 }
 
 
+#define BENCH_NSECT	64
+
+static uint8_t bench_pio[BENCH_NSECT * SECTSIZE];
+static uint8_t bench_dma[BENCH_NSECT * SECTSIZE];
+
+int
+mon_diskbench(int argc, char **argv, struct Trapframe *tf)
+{
+	uint64_t t0, t1, t2;
+	int r;
+
+	if (!disk_has_dma()) {
+		cprintf("No bus-master IDE controller\n");
+		return 0;
+	}
+
+	t0 = read_tsc();
+	r = ide_pio_read(0, bench_pio, BENCH_NSECT);
+	t1 = read_tsc();
+	if (r >= 0)
+		r = disk_read(0, bench_dma, BENCH_NSECT);
+	t2 = read_tsc();
+	if (r < 0) {
+		cprintf("diskbench: %e\n", r);
+		return 0;
+	}
+
+	cprintf("%d sectors: PIO %llu cycles, DMA %llu cycles, data %s\n",
+		BENCH_NSECT, t1 - t0, t2 - t1,
+		memcmp(bench_pio, bench_dma, sizeof(bench_pio)) == 0
+		? "matches" : "DIFFERS");
+	return 0;
+}
+
+// What ran between the previous timeline point and each of these.
+static const char * const boot_phases[BT_NPHASE] = {
+	[BT_BOOTSECT]	= "BIOS",
+	[BT_BOOTMAIN]	= "boot.S",
+	[BT_LOADER]	= "bootmain: read loader",
+	[BT_LOADED]	= "loader: read kernel",
+	[BT_ENTRY]	= "jump to kernel",
+	[BT_PAGING]	= "entry.S: enable paging",
+	[BT_I386_INIT]	= "i386_init: clear BSS",
+	[BT_CONS_INIT]	= "cons_init",
+	[BT_MEM_INIT]	= "mem_init",
+	[BT_KMEM_INIT]	= "kmem_init",
+	[BT_IPC_INIT]	= "ipc_init",
+	[BT_FPU_INIT]	= "fpu_init",
+	[BT_TSC_INIT]	= "tsc_init",
+	[BT_TIMER_INIT]	= "timer_init",
+	[BT_DISK_INIT]	= "disk_init",
+	[BT_BACKTRACE]	= "test_backtrace",
+	[BT_MONITOR]	= "to monitor prompt",
+};
+
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+	uint64_t hz, prev, total;
+	int i;
+
+	if (bootinfo.bi_magic != BOOTINFO_MAGIC) {
+		cprintf("Not booted by the JOS boot loader: no timeline\n");
+		return 0;
+	}
+
+	hz = tsc_freq();
+	cprintf("Kernel loaded by %s%s; TSC at %llu MHz\n",
+		bootinfo.bi_flags & BI_DMA ? "DMA" : "PIO",
+		bootinfo.bi_flags & BI_ZIMAGE ? " from a compressed image" : "",
+		hz / 1000000);
+
+	// The BIOS runs before the first stamp, so it can't be timed.
+	prev = bootinfo.bi_tsc[BT_BOOTSECT];
+	for (i = BT_BOOTSECT + 1; i < BT_NPHASE; i++) {
+		cprintf("  %-26s %12llu cycles %8llu us\n", boot_phases[i],
+			bootinfo.bi_tsc[i] - prev,
+			(bootinfo.bi_tsc[i] - prev) * 1000000 / hz);
+		prev = bootinfo.bi_tsc[i];
+	}
+	total = prev - bootinfo.bi_tsc[BT_BOOTSECT];
+	cprintf("  %-26s %12llu cycles %8llu us\n", "total",
+		total, total * 1000000 / hz);
+	return 0;
+}
+
+int
+mon_pagecache(int argc, char **argv, struct Trapframe *tf)
+{
+	page_cache_stats();
+	return 0;
+}
+
+int
+mon_slabinfo(int argc, char **argv, struct Trapframe *tf)
+{
+	kmem_cache_stats();
+	return 0;
+}
+
 
 /***** Kernel monitor command interpreter *****/
 
@@ -163,6 +273,9 @@ monitor(struct Trapframe *tf)
 	cprintf("Welcome to the JOS kernel monitor!\n");
 	cprintf("Type 'help' for a list of commands.\n");
 
+	// The boot timeline ends at the first prompt.
+	if (!bootinfo.bi_tsc[BT_MONITOR])
+		boot_stamp(BT_MONITOR);
 
 	while (1) {
 		buf = readline("K> ");
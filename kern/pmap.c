@@ -0,0 +1,1277 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/pmap.h>
+#include <kern/kclock.h>
+#include <kern/bootinfo.h>
+#include <kern/cpu.h>
+
+// These variables are set by i386_detect_memory()
+size_t npages;			// Amount of physical memory (in pages)
+static size_t npages_basemem;	// Amount of base memory (in pages)
+
+// These variables are set in mem_init()
+pde_t *kern_pgdir;		// Kernel's initial page directory
+struct PageInfo *pages;		// Physical page state array
+
+// Buddy allocator free lists: free_area[k] holds free blocks of 2^k
+// pages, each aligned to its size.
+static struct PageInfo *free_area[MAX_ORDER + 1];
+static size_t free_count[MAX_ORDER + 1];
+
+// Per-CPU caches of free single pages, in front of the free lists.
+// Most page_alloc and page_free calls are served from the current
+// CPU's cache, so they stay off the free lists (which other CPUs
+// share), and a page freed on one CPU is reused there while it is
+// still in that CPU's cache.  A cache is refilled from and drained to
+// the free lists PCP_BATCH pages at a time.
+#define PCP_BATCH	16
+#define PCP_HIGH	64	// most pages a cache holds
+
+struct PageCache {
+	struct PageInfo *pc_list;	// most recently freed first
+	int pc_count;
+	uint32_t pc_hits;		// allocations served from pc_list
+	uint32_t pc_misses;		// allocations that had to refill
+	uint32_t pc_drains;		// batches given back
+};
+
+static struct PageCache page_caches[NCPU];
+
+// Free pages that have already been zeroed, refilled by page_zero_idle
+// while the kernel has nothing else to do, so that page_alloc with
+// ALLOC_ZERO usually doesn't zero a page on the caller's time.
+#define ZPOOL_TARGET	64
+#define CPUID_SSE2	(1 << 26)	// CPUID leaf 1, %edx
+
+static struct PageInfo *zpool_list;
+static int zpool_count;
+static uint32_t zpool_hits;		// ALLOC_ZERO allocations from the pool
+static uint32_t zpool_misses;		// ... and ones we had to zero
+static bool cpu_has_sse2;		// for non-temporal stores
+
+static void check_page_alloc(void);
+static void check_cow(void);
+static void check_page_map_batch(void);
+static int pgtable_unshare(pde_t *pgdir, const void *va);
+static bool page_reclaim(void);
+
+// The page directory entry.S runs on (kern/entrypgdir.c)
+extern pde_t entry_pgdir[];
+
+// --------------------------------------------------------------
+// Detect machine's physical memory setup.
+// --------------------------------------------------------------
+
+static int
+nvram_read(int r)
+{
+	return mc146818_read(r) | (mc146818_read(r + 1) << 8);
+}
+
+static const char *
+mmap_type(uint32_t type)
+{
+	static const char * const names[] = {
+		[MMAP_RAM]	= "usable",
+		[MMAP_RESERVED]	= "reserved",
+		[MMAP_ACPI]	= "ACPI data",
+		[MMAP_NVS]	= "ACPI NVS",
+		[MMAP_UNUSABLE]	= "unusable",
+	};
+
+	if (type < ARRAY_SIZE(names) && names[type])
+		return names[type];
+	return "unknown";
+}
+
+// Size memory from the firmware's memory map (see inc/boot.h).
+// Returns false if the boot loader didn't hand us one.
+static bool
+i386_detect_memory_map(size_t *basemem, size_t *totalmem)
+{
+	struct Mmap *mm;
+	uint64_t start, end, top = 0;
+	int i, n;
+
+	if ((n = bootinfo_nmmap()) == 0)
+		return false;
+
+	*basemem = 0;
+	cprintf("Physical memory map:\n");
+	for (i = 0; i < n; i++) {
+		mm = &bootinfo.bi_mmap[i];
+		start = mm->mm_addr;
+		end = mm->mm_addr + mm->mm_len;
+		cprintf("  [mem %08llx-%08llx] %s\n",
+			start, end - 1, mmap_type(mm->mm_type));
+		if (mm->mm_type != MMAP_RAM || mm->mm_len == 0)
+			continue;
+		if (start == 0)
+			*basemem = MIN(end, IOPHYSMEM) / 1024;
+		top = MAX(top, end);
+	}
+
+	// Physical addresses are 32 bits wide.
+	*totalmem = MIN(top, 0x100000000ULL) / 1024;
+	return *totalmem != 0;
+}
+
+static void
+i386_detect_memory(void)
+{
+	size_t basemem, extmem, ext16mem, totalmem;
+
+	if (i386_detect_memory_map(&basemem, &totalmem))
+		goto done;
+
+	// Use CMOS calls to measure available base & extended memory.
+	// (CMOS calls return results in kilobytes.)
+	basemem = nvram_read(NVRAM_BASELO);
+	extmem = nvram_read(NVRAM_EXTLO);
+	ext16mem = nvram_read(NVRAM_EXT16LO) * 64;
+
+	// Calculate the number of physical pages available in both base
+	// and extended memory.
+	if (ext16mem)
+		totalmem = 16 * 1024 + ext16mem;
+	else if (extmem)
+		totalmem = 1 * 1024 + extmem;
+	else
+		totalmem = basemem;
+
+done:
+	npages = totalmem / (PGSIZE / 1024);
+	npages_basemem = basemem / (PGSIZE / 1024);
+
+	cprintf("Physical memory: %uK available, base = %uK, extended = %uK\n",
+		totalmem, basemem, totalmem - basemem);
+}
+
+// --------------------------------------------------------------
+// Set up the kernel part of the address space.
+// --------------------------------------------------------------
+
+// Map all of physical memory at KERNBASE, as far as it fits below
+// 4GB, with 4MB global pages.  entry_pgdir already maps the first
+// 4MB this way; this adds the rest.  The new entries were not present
+// before, so no TLB entries can be stale.
+static void
+boot_map_direct(pde_t *pgdir)
+{
+	uint64_t top = (uint64_t) npages * PGSIZE;
+	physaddr_t pa;
+
+	for (pa = PTSIZE; pa < top && pa < -KERNBASE; pa += PTSIZE)
+		pgdir[PDX(KERNBASE + pa)] = pa | PTE_P | PTE_W | PTE_PS | PTE_G;
+}
+
+// This simple physical memory allocator is used only while JOS is
+// setting up its virtual memory system.  page_alloc() is the real
+// allocator.
+//
+// If n>0, allocates enough pages of contiguous physical memory to hold
+// 'n' bytes.  Doesn't initialize the memory.  Returns a kernel virtual
+// address.
+//
+// If n==0, returns the address of the next free page without
+// allocating anything.
+static void *
+boot_alloc(uint32_t n)
+{
+	static char *nextfree;	// virtual address of next byte of free memory
+	char *result;
+
+	// Initialize nextfree if this is the first time.
+	// 'end' is a magic symbol automatically generated by the linker,
+	// which points to the end of the kernel's bss segment:
+	// the first virtual address that the linker did *not* assign
+	// to any kernel code or global variables.
+	if (!nextfree) {
+		extern char end[];
+		nextfree = ROUNDUP((char *) end, PGSIZE);
+	}
+
+	result = nextfree;
+	nextfree = ROUNDUP(nextfree + n, PGSIZE);
+	if ((uint64_t) PADDR(nextfree) > MIN((uint64_t) npages * PGSIZE,
+					     (uint64_t) -KERNBASE))
+		panic("boot_alloc: out of memory");
+	return result;
+}
+
+// Set up the kernel's view of physical memory.
+void
+mem_init(void)
+{
+	uint32_t edx;
+
+	i386_detect_memory();
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	cpu_has_sse2 = (edx & CPUID_SSE2) != 0;
+	kern_pgdir = entry_pgdir;
+	boot_map_direct(kern_pgdir);
+
+	// entry.S was the last code to need the identity mapping of the
+	// first 4MB.  Drop it, so that a null pointer faults instead of
+	// reading physical page 0.  It isn't global, so reloading CR3
+	// flushes it.
+	kern_pgdir[0] = 0;
+	tlbflush();
+
+	// Allocate an array of npages 'struct PageInfo's and store it in
+	// 'pages'.
+	pages = boot_alloc(npages * sizeof(struct PageInfo));
+	memset(pages, 0, npages * sizeof(struct PageInfo));
+
+	page_init();
+	check_page_alloc();
+	check_cow();
+	check_page_map_batch();
+}
+
+// --------------------------------------------------------------
+// Tracking of physical pages.
+// The 'pages' array has one 'struct PageInfo' entry per physical page.
+// Free pages are kept by a buddy allocator: a free block of 2^k pages
+// starts at a multiple of 2^k pages, and when it is freed it merges
+// with its "buddy" -- the other half of the block of 2^(k+1) pages it
+// came from -- if that is free too.  So both allocation and freeing
+// take O(MAX_ORDER) steps, and contiguous runs of up to 4MB can be
+// had for DMA buffers and superpages.
+// --------------------------------------------------------------
+
+// Whether the page at 'pa' is RAM according to the memory map.  With
+// no map, everything below npages is, except for the I/O hole.
+static bool
+page_is_ram(physaddr_t pa)
+{
+	struct Mmap *mm;
+	int i, n;
+
+	if ((n = bootinfo_nmmap()) == 0)
+		return pa < IOPHYSMEM || pa >= EXTPHYSMEM;
+	for (i = 0; i < n; i++) {
+		mm = &bootinfo.bi_mmap[i];
+		if (mm->mm_type == MMAP_RAM && mm->mm_addr <= pa
+		    && pa + PGSIZE <= mm->mm_addr + mm->mm_len)
+			return true;
+	}
+	return false;
+}
+
+static void
+free_insert(struct PageInfo *pp, int order)
+{
+	pp->pp_order = order;
+	pp->pp_link = free_area[order];
+	if (pp->pp_link)
+		pp->pp_link->pp_pprev = &pp->pp_link;
+	pp->pp_pprev = &free_area[order];
+	free_area[order] = pp;
+	free_count[order]++;
+}
+
+static void
+free_remove(struct PageInfo *pp)
+{
+	free_count[pp->pp_order]--;
+	*pp->pp_pprev = pp->pp_link;
+	if (pp->pp_link)
+		pp->pp_link->pp_pprev = pp->pp_pprev;
+	pp->pp_link = NULL;
+	pp->pp_pprev = NULL;
+	pp->pp_order = PP_NOTFREE;
+}
+
+//
+// Initialize page structures and the free lists.
+// After this is done, NEVER use boot_alloc again.  ONLY use the page
+// allocator functions below to allocate and deallocate physical
+// memory via the free lists.
+//
+void
+page_init(void)
+{
+	size_t i, first_free, nkern;
+
+	for (i = 0; i < npages; i++)
+		pages[i].pp_order = PP_NOTFREE;
+
+	// Free every page that is RAM, except
+	//  1) page 0, which holds the real-mode IDT and BIOS structures,
+	//  2) [IOPHYSMEM, EXTPHYSMEM), the I/O hole, and
+	//  3) the kernel and everything boot_alloc has handed out,
+	//     which follow the hole.
+	// Pages the kernel can't reach through its KERNBASE mapping are
+	// left out too.
+	first_free = PGNUM(PADDR(boot_alloc(0)));
+	nkern = MIN(npages, PGNUM(-KERNBASE));
+	for (i = 1; i < nkern; i++) {
+		if (i >= PGNUM(IOPHYSMEM) && i < first_free)
+			continue;
+		if (page_is_ram(i << PGSHIFT))
+			page_free_order(&pages[i], 0);
+	}
+}
+
+// Take a block of 2^order pages off the free lists, or return NULL.
+static struct PageInfo *
+buddy_alloc(int order)
+{
+	struct PageInfo *pp;
+	int k;
+
+	// Take the smallest free block that is big enough ...
+	for (k = order; k <= MAX_ORDER && !free_area[k]; k++)
+		/* do nothing */;
+	if (k > MAX_ORDER)
+		return NULL;
+	pp = free_area[k];
+	free_remove(pp);
+
+	// ... and give back its upper halves until it's the right size.
+	while (k > order) {
+		k--;
+		free_insert(pp + (1 << k), k);
+	}
+	return pp;
+}
+
+//
+// Allocates a block of 2^order physical pages, aligned to its size.
+// If (alloc_flags & ALLOC_ZERO), fills the entire block with '\0'
+// bytes.  Does NOT increment the reference count of the page - the
+// caller must do these if necessary (either explicitly or via
+// page_insert).
+//
+// Returns NULL if out of free memory.
+//
+struct PageInfo *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct PageInfo *pp;
+
+	assert(order >= 0 && order <= MAX_ORDER);
+
+	if (!(pp = buddy_alloc(order)) && page_reclaim())
+		pp = buddy_alloc(order);
+	if (!pp)
+		return NULL;
+
+	if (alloc_flags & ALLOC_ZERO)
+		memset(page2kva(pp), 0, PGSIZE << order);
+	return pp;
+}
+
+// Move up to 'n' pages from the free lists into cache 'pc'.
+static void
+pcp_refill(struct PageCache *pc, int n)
+{
+	struct PageInfo *pp;
+
+	while (n-- > 0 && (pp = buddy_alloc(0)) != NULL) {
+		pp->pp_order = PP_CACHED;
+		pp->pp_link = pc->pc_list;
+		pc->pc_list = pp;
+		pc->pc_count++;
+	}
+}
+
+// Give back all but the 'keep' most recently freed pages in cache
+// 'pc' to the free lists.
+static void
+pcp_drain(struct PageCache *pc, int keep)
+{
+	struct PageInfo **pprev, *pp;
+	int i;
+
+	pprev = &pc->pc_list;
+	for (i = 0; i < keep && *pprev; i++)
+		pprev = &(*pprev)->pp_link;
+	while ((pp = *pprev) != NULL) {
+		*pprev = pp->pp_link;
+		pp->pp_link = NULL;
+		pp->pp_order = PP_NOTFREE;
+		page_free_order(pp, 0);
+		pc->pc_count--;
+	}
+	pc->pc_drains++;
+}
+
+//
+// Give every free page held outside the free lists back to them, so
+// that it can be allocated again and merge with its buddies.  Called
+// when the free lists can't satisfy an allocation.  Returns true if
+// that freed anything.
+//
+static bool
+page_reclaim(void)
+{
+	struct PageInfo *pp;
+	int i;
+	bool freed = false;
+
+	for (i = 0; i < NCPU; i++)
+		if (page_caches[i].pc_count > 0) {
+			pcp_drain(&page_caches[i], 0);
+			freed = true;
+		}
+
+	// The pre-zeroed pool is only a head start; the idle loop can
+	// refill it once memory is less tight.
+	while ((pp = zpool_list) != NULL) {
+		zpool_list = pp->pp_link;
+		zpool_count--;
+		pp->pp_link = NULL;
+		pp->pp_order = PP_NOTFREE;
+		page_free_order(pp, 0);
+		freed = true;
+	}
+	return freed;
+}
+
+//
+// Allocates a physical page, from the current CPU's page cache if it
+// can.
+//
+struct PageInfo *
+page_alloc(int alloc_flags)
+{
+	struct PageCache *pc = &page_caches[cpunum()];
+	struct PageInfo *pp;
+
+	if (alloc_flags & ALLOC_ZERO) {
+		if ((pp = zpool_list) != NULL) {
+			zpool_list = pp->pp_link;
+			zpool_count--;
+			zpool_hits++;
+			pp->pp_link = NULL;
+			pp->pp_order = PP_NOTFREE;
+			return pp;
+		}
+		zpool_misses++;
+	}
+
+	if (pc->pc_list)
+		pc->pc_hits++;
+	else {
+		pc->pc_misses++;
+		pcp_refill(pc, PCP_BATCH);
+		if (!pc->pc_list && page_reclaim())
+			pcp_refill(pc, PCP_BATCH);
+		if (!pc->pc_list)
+			return NULL;
+	}
+
+	pp = pc->pc_list;
+	pc->pc_list = pp->pp_link;
+	pc->pc_count--;
+	pp->pp_link = NULL;
+	pp->pp_order = PP_NOTFREE;
+
+	if (alloc_flags & ALLOC_ZERO)
+		memset(page2kva(pp), 0, PGSIZE);
+	return pp;
+}
+
+//
+// Return a block of 2^order pages allocated by page_alloc_order to
+// the free lists, merging it with its buddy for as long as the buddy
+// is free.
+// (This function should only be called when pp->pp_ref reaches 0.)
+//
+void
+page_free_order(struct PageInfo *pp, int order)
+{
+	size_t pfn = pp - pages, buddy;
+
+	if (pp->pp_ref != 0 || pp->pp_order != PP_NOTFREE)
+		panic("page_free: page %08x is in use or already free",
+		      page2pa(pp));
+	assert(order >= 0 && order <= MAX_ORDER);
+	assert(pfn % (1 << order) == 0);
+
+	for (; order < MAX_ORDER; order++) {
+		buddy = pfn ^ (1 << order);
+		if (buddy >= npages || pages[buddy].pp_order != order)
+			break;
+		free_remove(&pages[buddy]);
+		pfn &= ~(1 << order);
+	}
+	free_insert(&pages[pfn], order);
+}
+
+//
+// Return a page to the current CPU's page cache.
+//
+void
+page_free(struct PageInfo *pp)
+{
+	struct PageCache *pc = &page_caches[cpunum()];
+
+	if (pp->pp_ref != 0 || pp->pp_order != PP_NOTFREE)
+		panic("page_free: page %08x is in use or already free",
+		      page2pa(pp));
+
+	pp->pp_order = PP_CACHED;
+	pp->pp_link = pc->pc_list;
+	pc->pc_list = pp;
+	if (++pc->pc_count > PCP_HIGH)
+		pcp_drain(pc, PCP_HIGH - PCP_BATCH);
+}
+
+// Zero a page with non-temporal stores, which bypass the cache: the
+// page may not be used for a long time, so it shouldn't push anything
+// else out of the cache.
+static void
+zero_page_nt(void *va)
+{
+	uint32_t *p, *end = va + PGSIZE;
+
+	if (!cpu_has_sse2) {
+		memset(va, 0, PGSIZE);
+		return;
+	}
+	for (p = va; p < end; p += 4)
+		asm volatile("movnti %1, 0(%0)\n\t"
+			     "movnti %1, 4(%0)\n\t"
+			     "movnti %1, 8(%0)\n\t"
+			     "movnti %1, 12(%0)"
+			     : : "r" (p), "r" (0) : "memory");
+	// Non-temporal stores are weakly ordered; finish them before
+	// the page can be handed out.
+	asm volatile("sfence" : : : "memory");
+}
+
+//
+// Zero one free page into the pre-zeroed pool, unless it is full.
+// Call this when the CPU would otherwise sit idle; each call does a
+// page's worth of work, so it never holds things up for long.
+// Returns false if there was nothing to do.
+//
+bool
+page_zero_idle(void)
+{
+	struct PageInfo *pp;
+
+	// Take a cold page from the free lists, not a cache-warm one
+	// from the page cache.  Never reclaim for it: that would empty
+	// the page caches and the pool itself to zero one page.
+	if (zpool_count >= ZPOOL_TARGET || !(pp = buddy_alloc(0)))
+		return false;
+	zero_page_nt(page2kva(pp));
+	pp->pp_order = PP_CACHED;
+	pp->pp_link = zpool_list;
+	zpool_list = pp;
+	zpool_count++;
+	return true;
+}
+
+// Print each CPU's page cache statistics.
+void
+page_cache_stats(void)
+{
+	struct PageCache *pc;
+	uint32_t nalloc;
+	int i;
+
+	cprintf("cpu  cached      hits    misses  drains  hit rate\n");
+	for (i = 0; i < NCPU; i++) {
+		pc = &page_caches[i];
+		nalloc = pc->pc_hits + pc->pc_misses;
+		if (nalloc == 0 && pc->pc_count == 0)
+			continue;
+		cprintf("%3d  %6d  %8u  %8u  %6u  %7u%%\n", i, pc->pc_count,
+			pc->pc_hits, pc->pc_misses, pc->pc_drains,
+			nalloc ? (uint32_t) ((uint64_t) pc->pc_hits * 100 / nalloc) : 0);
+	}
+	cprintf("pre-zeroed pages: %d; %u zeroed allocations from the pool, "
+		"%u zeroed on demand\n", zpool_count, zpool_hits, zpool_misses);
+}
+
+//
+// Decrement the reference count on a page,
+// freeing it if there are no more refs.
+//
+void
+page_decref(struct PageInfo* pp)
+{
+	if (--pp->pp_ref == 0)
+		page_free(pp);
+}
+
+// Given 'pgdir', a pointer to a page directory, pgdir_walk returns
+// a pointer to the page table entry (PTE) for linear address 'va'.
+// This requires walking the two-level page table structure.
+//
+// The relevant page table page might not exist yet.
+// If this is true, and create == false, then pgdir_walk returns NULL.
+// Otherwise, pgdir_walk allocates a new page table page with
+// page_alloc.  If the allocation fails, pgdir_walk returns NULL.
+// Otherwise, the new page's reference count is incremented, the page
+// is cleared, and pgdir_walk returns a pointer into the new page
+// table page.
+//
+// With create != 0 the caller may change the PTE, so a page table
+// shared with other address spaces is unshared first (see
+// pgtable_unshare); if that runs out of memory, pgdir_walk returns
+// NULL.
+//
+// 'va' must not be covered by a 4MB page.
+pte_t *
+pgdir_walk(pde_t *pgdir, const void *va, int create)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	struct PageInfo *pp;
+	pte_t *pgtab;
+
+	assert(!(*pde & PTE_PS));
+	if ((*pde & PTE_COW) && create && pgtable_unshare(pgdir, va) < 0)
+		return NULL;
+	if (!(*pde & PTE_P)) {
+		if (!create || !(pp = page_alloc(ALLOC_ZERO)))
+			return NULL;
+		pp->pp_ref++;
+		*pde = page2pa(pp) | PTE_P | PTE_W | PTE_U;
+	}
+	pgtab = KADDR(PTE_ADDR(*pde));
+	return &pgtab[PTX(va)];
+}
+
+//
+// Return the page mapped at virtual address 'va'.
+// If pte_store is not zero, then we store in it the address
+// of the pte for this page.
+//
+// Return NULL if there is no page mapped at va.
+//
+struct PageInfo *
+page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
+{
+	pte_t *pte;
+
+	if (!(pte = pgdir_walk(pgdir, va, 0)) || !(*pte & PTE_P))
+		return NULL;
+	if (pte_store)
+		*pte_store = pte;
+	return pa2page(PTE_ADDR(*pte));
+}
+
+//
+// Unmaps the physical page at virtual address 'va'.
+// If there is no physical page at that address, silently does nothing.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if 'va' is in a page table shared copy-on-write with
+//	other address spaces, and there was no memory to unshare it
+//	(this can't happen if the caller got the PTE from pgdir_walk
+//	with create set)
+//
+int
+page_remove(pde_t *pgdir, void *va)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	if (!(pp = page_lookup(pgdir, va, &pte)))
+		return 0;
+	// Don't unmap the page from everyone sharing the page table.
+	if (!(pte = pgdir_walk(pgdir, va, 1)))
+		return -E_NO_MEM;
+	*pte = 0;
+	tlb_invalidate(pgdir, va);
+	page_decref(pp);
+	return 0;
+}
+
+//
+// Map the physical page 'pp' at virtual address 'va'.
+// The permissions (the low 12 bits) of the page table entry
+// should be set to 'perm|PTE_P'.  Any page already mapped at 'va' is
+// page_remove()d first.  pp->pp_ref is incremented if the insertion
+// succeeds.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if page table couldn't be allocated
+//
+int
+page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
+{
+	pte_t *pte;
+
+	if (!(pte = pgdir_walk(pgdir, va, 1)))
+		return -E_NO_MEM;
+	// Take the reference first, in case pp is already mapped at va.
+	pp->pp_ref++;
+	if (*pte & PTE_P)
+		page_remove(pgdir, va);
+	*pte = page2pa(pp) | perm | PTE_P;
+	return 0;
+}
+
+//
+// Invalidate a TLB entry, but only if the page tables being
+// edited are the ones currently in use by the processor.
+//
+void
+tlb_invalidate(pde_t *pgdir, void *va)
+{
+	if (rcr3() == PADDR(pgdir))
+		invlpg(va);
+}
+
+//
+// Flush all TLB entries for 'pgdir' if it is in use, except for the
+// global kernel mappings.
+//
+static void
+tlb_flush(pde_t *pgdir)
+{
+	if (rcr3() == PADDR(pgdir))
+		lcr3(PADDR(pgdir));
+}
+
+// --------------------------------------------------------------
+// Copy-on-write address spaces.
+// pgdir_copy_cow gives a new address space the same user memory as
+// another without copying any of it -- not even the page tables.
+// Each page table is shared, through PDEs marked read-only and
+// PTE_COW, so a fork costs one PDE per 4MB of address space in use.
+//
+// The first write fault in a shared 4MB region unshares its page
+// table: the writer gets its own copy of the table, and every
+// writable page in it becomes read-only and PTE_COW in both copies.
+// That fault, and later ones on other pages in the region, then go
+// through the page-level copy-on-write in page_fault_cow, which gives
+// the writer its own copy of the page.
+// --------------------------------------------------------------
+
+//
+// Give 'pgdir' a page table for 'va' of its own, if it is sharing one,
+// and make the table writable again.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if out of memory
+//
+static int
+pgtable_unshare(pde_t *pgdir, const void *va)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	struct PageInfo *ptp = pa2page(PTE_ADDR(*pde)), *npp;
+	pte_t *old, *new;
+	int i;
+
+	if (ptp->pp_ref > 1) {
+		if (!(npp = page_alloc(0)))
+			return -E_NO_MEM;
+		old = page2kva(ptp);
+		new = page2kva(npp);
+		for (i = 0; i < NPTENTRIES; i++) {
+			if (!(old[i] & PTE_P)) {
+				new[i] = 0;
+				continue;
+			}
+			// The other sharers' PDE keeps the table read-only
+			// for them, so changing it under them is safe.
+			if (old[i] & PTE_W)
+				old[i] = (old[i] & ~PTE_W) | PTE_COW;
+			new[i] = old[i];
+			pa2page(PTE_ADDR(old[i]))->pp_ref++;
+		}
+		npp->pp_ref++;
+		ptp->pp_ref--;
+		ptp = npp;
+	}
+	// If nobody else uses the table any more, the pages its writable
+	// PTEs map belong to us alone.
+	*pde = page2pa(ptp) | PTE_P | PTE_W | PTE_U;
+	tlb_flush(pgdir);
+	return 0;
+}
+
+//
+// Map all of the user memory (below UTOP) of 'src' into 'dst' at the
+// same addresses, copy-on-write, by sharing 'src's page tables.
+// 'dst' must have no user mappings yet.
+//
+int
+pgdir_copy_cow(pde_t *dst, pde_t *src)
+{
+	uintptr_t va;
+
+	for (va = 0; va < UTOP; va += PTSIZE) {
+		if (!(src[PDX(va)] & PTE_P))
+			continue;
+		src[PDX(va)] = (src[PDX(va)] & ~PTE_W) | PTE_COW;
+		dst[PDX(va)] = src[PDX(va)];
+		pa2page(PTE_ADDR(src[PDX(va)]))->pp_ref++;
+	}
+	tlb_flush(src);
+	return 0;
+}
+
+//
+// Handle a write fault at 'va' in 'pgdir'.  If the page there is
+// copy-on-write, give 'pgdir' a private, writable copy of it -- or
+// just make it writable if nobody else maps it any more.
+//
+// RETURNS:
+//   0 if the fault was handled
+//   -E_FAULT, if the page isn't copy-on-write, so the fault is real
+//   -E_NO_MEM, if out of memory
+//
+int
+page_fault_cow(pde_t *pgdir, void *va)
+{
+	struct PageInfo *pp, *npp;
+	pte_t *pte;
+	int perm, r;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if ((uintptr_t) va >= UTOP || !(pp = page_lookup(pgdir, va, &pte))
+	    || !(*pte & (PTE_W | PTE_COW)))
+		return -E_FAULT;
+
+	if (pgdir[PDX(va)] & PTE_COW) {
+		if ((r = pgtable_unshare(pgdir, va)) < 0)
+			return r;
+		pte = pgdir_walk(pgdir, va, 0);
+		if (*pte & PTE_W)
+			return 0;
+	} else if (!(*pte & PTE_COW))
+		return -E_FAULT;
+
+	perm = (*pte & PTE_SYSCALL & ~PTE_COW) | PTE_W;
+	if (pp->pp_ref == 1) {
+		*pte = page2pa(pp) | perm;
+		tlb_invalidate(pgdir, va);
+		return 0;
+	}
+
+	if (!(npp = page_alloc(0)))
+		return -E_NO_MEM;
+	memcpy(page2kva(npp), page2kva(pp), PGSIZE);
+	return page_insert(pgdir, npp, va, perm);
+}
+
+//
+// Unmap every user page in 'pgdir', free its page tables, and free
+// the page directory itself.
+//
+void
+pgdir_destroy(pde_t *pgdir)
+{
+	uintptr_t va;
+	pte_t *pgtab;
+	int i;
+
+	for (va = 0; va < UTOP; va += PTSIZE) {
+		if (!(pgdir[PDX(va)] & PTE_P))
+			continue;
+		pgtab = KADDR(PTE_ADDR(pgdir[PDX(va)]));
+		// Leave a shared page table to its other users, or take
+		// it over if there are none.
+		if ((pgdir[PDX(va)] & PTE_COW)
+		    && pa2page(PADDR(pgtab))->pp_ref > 1) {
+			pgdir[PDX(va)] = 0;
+			page_decref(pa2page(PADDR(pgtab)));
+			continue;
+		}
+		pgdir[PDX(va)] &= ~PTE_COW;
+		for (i = 0; i < NPTENTRIES; i++)
+			if (pgtab[i] & PTE_P)
+				page_remove(pgdir, (void *) (va + i * PGSIZE));
+		pgdir[PDX(va)] = 0;
+		page_decref(pa2page(PADDR(pgtab)));
+	}
+	page_decref(pa2page(PADDR(pgdir)));
+}
+
+// --------------------------------------------------------------
+// Batched mapping.
+// Building an address space one page_insert at a time pays for a
+// TLB invalidation per page.  page_map_batch applies a whole array of
+// mappings and flushes the TLB at most once, at the end.
+// --------------------------------------------------------------
+
+//
+// Check that the page at 'srcva' in 'srcpgdir' may be mapped
+// elsewhere with permissions 'perm', and store it in '*ppp'.
+// Once this has succeeded, mapping the page can only fail for lack of
+// memory for the destination's page table.
+//
+// RETURNS:
+//   0 on success
+//   -E_INVAL if 'srcva' isn't page-aligned and below UTOP, if 'perm'
+//	is invalid (it must include PTE_U and PTE_P and nothing outside
+//	PTE_SYSCALL), if nothing is mapped at 'srcva', or if 'perm' has
+//	PTE_W but the page is read-only in 'srcpgdir'
+//   -E_NO_MEM if the source's page table had to be unshared, and
+//	there was no memory for that
+//
+int
+page_map_check(pde_t *srcpgdir, void *srcva, int perm,
+	       struct PageInfo **ppp)
+{
+	pte_t *pte;
+
+	if ((uintptr_t) srcva >= UTOP || PGOFF(srcva))
+		return -E_INVAL;
+	if ((perm & (PTE_U | PTE_P)) != (PTE_U | PTE_P)
+	    || (perm & ~PTE_SYSCALL))
+		return -E_INVAL;
+	if (!(*ppp = page_lookup(srcpgdir, srcva, &pte)))
+		return -E_INVAL;
+
+	// A page can only be mapped writable if it is writable in the
+	// source, and not while the source shares its page table.
+	if (perm & PTE_W) {
+		if (srcpgdir[PDX(srcva)] & PTE_COW) {
+			if (pgtable_unshare(srcpgdir, srcva) < 0)
+				return -E_NO_MEM;
+			pte = pgdir_walk(srcpgdir, srcva, 0);
+		}
+		if (!(*pte & PTE_W))
+			return -E_INVAL;
+	}
+	return 0;
+}
+
+//
+// Map pages of 'srcpgdir' as described by each of the 'n' entries of
+// 'ops', as page_insert would, and set each entry's pm_result to 0 or
+// a negative error code:
+//   -E_INVAL if pm_srcva or pm_dstva is not page-aligned and below
+//	UTOP, if pm_perm is invalid (it must include PTE_U and PTE_P
+//	and nothing outside PTE_SYSCALL), if nothing is mapped at
+//	pm_srcva, or if pm_perm has PTE_W but the page is read-only
+//	in 'srcpgdir'.
+//   -E_NO_MEM if a page table couldn't be allocated.
+// A failed entry doesn't stop the others.
+//
+// RETURNS:
+//   the number of entries that succeeded
+//
+int
+page_map_batch(pde_t *srcpgdir, struct PageMapOp *ops, int n)
+{
+	struct PageMapOp *op;
+	struct PageInfo *pp, *old;
+	pde_t *flush = NULL;
+	pte_t *pte;
+	int nok = 0;
+
+	for (op = ops; op < ops + n; op++) {
+		if ((uintptr_t) op->pm_dstva >= UTOP || PGOFF(op->pm_dstva)) {
+			op->pm_result = -E_INVAL;
+			continue;
+		}
+		if ((op->pm_result = page_map_check(srcpgdir, op->pm_srcva,
+						    op->pm_perm, &pp)) < 0)
+			continue;
+		if (!(pte = pgdir_walk(op->pm_dstpgdir, op->pm_dstva, 1))) {
+			op->pm_result = -E_NO_MEM;
+			continue;
+		}
+
+		pp->pp_ref++;
+		if (*pte & PTE_P) {
+			// Replacing a mapping can leave a stale TLB entry,
+			// but only in the address space that is loaded.
+			old = pa2page(PTE_ADDR(*pte));
+			*pte = 0;
+			page_decref(old);
+			if (rcr3() == PADDR(op->pm_dstpgdir))
+				flush = op->pm_dstpgdir;
+		}
+		*pte = page2pa(pp) | op->pm_perm | PTE_P;
+		nok++;
+	}
+
+	if (flush)
+		tlb_flush(flush);
+	return nok;
+}
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+static size_t
+nfree_pages(void)
+{
+	size_t n = 0;
+	int k;
+
+	for (k = 0; k <= MAX_ORDER; k++)
+		n += free_count[k] << k;
+	for (k = 0; k < NCPU; k++)
+		n += page_caches[k].pc_count;
+	return n + zpool_count;
+}
+
+//
+// Check the physical page allocator (page_alloc(), page_free(),
+// and page_init()).
+//
+static void
+check_page_alloc(void)
+{
+	struct PageInfo *pp, *pp0, *pp1, *pp2;
+	size_t before[MAX_ORDER + 1], nfree;
+	char *c;
+	int i, k;
+
+	if (!pages)
+		panic("'pages' is a null pointer!");
+
+	// check the free lists
+	nfree = 0;
+	for (k = 0; k <= MAX_ORDER; k++) {
+		before[k] = free_count[k];
+		for (i = 0, pp = free_area[k]; pp; pp = pp->pp_link, i++) {
+			assert(pp->pp_order == k);
+			assert((pp - pages) % (1 << k) == 0);
+			assert(*pp->pp_pprev == pp);
+			// no free page is below the kernel's end or in the hole
+			assert(page2pa(pp) != 0);
+			assert(page2pa(pp) + (PGSIZE << k) <= IOPHYSMEM
+			       || page2pa(pp) >= PADDR(boot_alloc(0)));
+		}
+		assert(i == free_count[k]);
+		nfree += i << k;
+	}
+	assert(nfree > 0);
+
+	// should be able to allocate three pages
+	assert((pp0 = page_alloc(0)));
+	assert((pp1 = page_alloc(0)));
+	assert((pp2 = page_alloc(0)));
+	assert(pp0 != pp1 && pp1 != pp2 && pp0 != pp2);
+	assert(nfree_pages() == nfree - 3);
+
+	// test flags; the page cache hands back the page freed last
+	memset(page2kva(pp0), 1, PGSIZE);
+	page_free(pp0);
+	assert((pp = page_alloc(ALLOC_ZERO)));
+	assert(pp == pp0);
+	c = page2kva(pp);
+	for (i = 0; i < PGSIZE; i++)
+		assert(c[i] == 0);
+	page_free(pp0);
+	page_free(pp1);
+	page_free(pp2);
+	assert(nfree_pages() == nfree);
+
+	// draining the cache must merge the blocks back together
+	pcp_drain(&page_caches[cpunum()], 0);
+	assert(page_caches[cpunum()].pc_count == 0);
+	for (k = 0; k <= MAX_ORDER; k++)
+		assert(free_count[k] == before[k]);
+
+	// blocks come out aligned to their size, and zeroed if asked
+	for (k = 1; k <= MAX_ORDER; k++) {
+		if (!(pp = page_alloc_order(k, ALLOC_ZERO)))
+			continue;
+		assert(page2pa(pp) % (PGSIZE << k) == 0);
+		c = page2kva(pp);
+		assert(c[0] == 0 && c[(PGSIZE << k) - 1] == 0);
+		page_free_order(pp, k);
+	}
+	for (k = 0; k <= MAX_ORDER; k++)
+		assert(free_count[k] == before[k]);
+
+	// with the free lists empty, a page sitting in a page cache
+	// still gets allocated
+	pp0 = NULL;
+	while ((pp = page_alloc_order(0, 0)) != NULL) {
+		pp->pp_link = pp0;
+		pp0 = pp;
+	}
+	pp1 = pp0;
+	pp0 = pp0->pp_link;
+	pp1->pp_link = NULL;
+	page_free(pp1);
+	// (idle zeroing leaves it there)
+	assert(page_caches[cpunum()].pc_count == 1 && zpool_count == 0);
+	assert(!page_zero_idle());
+	assert(page_caches[cpunum()].pc_count == 1 && zpool_count == 0);
+	assert(page_alloc_order(0, 0) == pp1);
+	assert(page_caches[cpunum()].pc_count == 0);
+	// ... and so does one in the pre-zeroed pool
+	page_free_order(pp1, 0);
+	assert(page_zero_idle() && zpool_count == 1);
+	assert(!page_zero_idle() && zpool_count == 1);
+	assert(page_alloc_order(0, 0) == pp1 && zpool_count == 0);
+	page_free_order(pp1, 0);
+	while ((pp = pp0) != NULL) {
+		pp0 = pp->pp_link;
+		pp->pp_link = NULL;
+		page_free_order(pp, 0);
+	}
+	for (k = 0; k <= MAX_ORDER; k++)
+		assert(free_count[k] == before[k]);
+
+	cprintf("check_page_alloc() succeeded!\n");
+}
+
+//
+// Check copy-on-write sharing between two address spaces.
+//
+static void
+check_cow(void)
+{
+	struct PageInfo *pp, *pp_ro, *pp_dir0, *pp_dir1, *hog, *hp;
+	pde_t *parent, *child;
+	pte_t *pte;
+	void *va = (void *) UTEXT, *va_ro = (void *) (UTEXT + PGSIZE);
+	size_t nfree = nfree_pages();
+
+	assert((pp_dir0 = page_alloc(ALLOC_ZERO)));
+	assert((pp_dir1 = page_alloc(ALLOC_ZERO)));
+	pp_dir0->pp_ref++;
+	pp_dir1->pp_ref++;
+	parent = page2kva(pp_dir0);
+	child = page2kva(pp_dir1);
+
+	// a writable page and a read-only one
+	assert((pp = page_alloc(0)));
+	assert((pp_ro = page_alloc(0)));
+	assert(page_insert(parent, pp, va, PTE_W | PTE_U) == 0);
+	assert(page_insert(parent, pp_ro, va_ro, PTE_U) == 0);
+	memset(page2kva(pp), 'p', PGSIZE);
+
+	// after the copy both share the page table, read-only
+	assert(pgdir_copy_cow(child, parent) == 0);
+	assert(child[PDX(va)] == parent[PDX(va)]);
+	assert((child[PDX(va)] & (PTE_W | PTE_COW)) == PTE_COW);
+	assert(pa2page(PTE_ADDR(child[PDX(va)]))->pp_ref == 2);
+	assert(page_lookup(child, va, &pte) == pp && pp->pp_ref == 1);
+	assert(page_lookup(child, va_ro, &pte) == pp_ro);
+
+	// a write fault in the child gives it its own table, then a copy
+	assert(page_fault_cow(child, va_ro) == -E_FAULT);
+	assert(page_fault_cow(child, va + 12) == 0);
+	assert(child[PDX(va)] != parent[PDX(va)]);
+	assert((child[PDX(va)] & (PTE_W | PTE_COW)) == PTE_W);
+	assert(page_lookup(child, va, &pte) != pp && (*pte & PTE_W));
+	assert(*(char *) page2kva(page_lookup(child, va, 0)) == 'p');
+	assert(page_lookup(child, va_ro, &pte) == pp_ro && pp_ro->pp_ref == 2);
+	assert(!(*pte & (PTE_W | PTE_COW)));
+	assert(pp->pp_ref == 1);
+
+	// the parent's page went copy-on-write when the table was split,
+	// but it is now the only user, so it just gets the page back
+	assert(page_lookup(parent, va, &pte) == pp);
+	assert((*pte & (PTE_W | PTE_COW)) == PTE_COW);
+	assert(page_fault_cow(parent, va) == 0);
+	assert((parent[PDX(va)] & (PTE_W | PTE_COW)) == PTE_W);
+	assert(page_lookup(parent, va, &pte) == pp);
+	assert((*pte & (PTE_W | PTE_COW)) == PTE_W);
+	pgdir_destroy(child);
+
+	// sharing again and destroying the child leaves the parent alone
+	assert((pp_dir1 = page_alloc(ALLOC_ZERO)));
+	pp_dir1->pp_ref++;
+	child = page2kva(pp_dir1);
+	assert(pgdir_copy_cow(child, parent) == 0);
+
+	// unmapping from a shared table needs memory, and fails cleanly
+	// without it
+	hog = NULL;
+	while ((hp = page_alloc(0)) != NULL) {
+		hp->pp_link = hog;
+		hog = hp;
+	}
+	assert(page_remove(child, va_ro) == -E_NO_MEM);
+	assert(page_lookup(child, va_ro, 0) == pp_ro);
+	while ((hp = hog) != NULL) {
+		hog = hp->pp_link;
+		hp->pp_link = NULL;
+		page_free(hp);
+	}
+	assert(page_remove(child, va_ro) == 0);
+	assert(!page_lookup(child, va_ro, 0));
+	assert(page_lookup(parent, va_ro, 0) == pp_ro && pp_ro->pp_ref == 1);
+
+	pgdir_destroy(child);
+	assert(pa2page(PTE_ADDR(parent[PDX(va)]))->pp_ref == 1);
+	assert(page_lookup(parent, va, 0) == pp && pp->pp_ref == 1);
+
+	pgdir_destroy(parent);
+	assert(nfree_pages() == nfree);
+
+	cprintf("check_cow() succeeded!\n");
+}
+
+//
+// Check page_map_batch.
+//
+static void
+check_page_map_batch(void)
+{
+	struct PageInfo *pp0, *pp1, *pp_dir0, *pp_dir1;
+	struct PageMapOp ops[6];
+	pde_t *src, *dst;
+	pte_t *pte;
+	char *va = (char *) UTEXT;
+	size_t nfree = nfree_pages();
+	int i;
+
+	assert((pp_dir0 = page_alloc(ALLOC_ZERO)));
+	assert((pp_dir1 = page_alloc(ALLOC_ZERO)));
+	pp_dir0->pp_ref++;
+	pp_dir1->pp_ref++;
+	src = page2kva(pp_dir0);
+	dst = page2kva(pp_dir1);
+
+	assert((pp0 = page_alloc(0)));
+	assert((pp1 = page_alloc(0)));
+	assert(page_insert(src, pp0, va, PTE_W | PTE_U) == 0);
+	assert(page_insert(src, pp1, va + PGSIZE, PTE_U) == 0);
+
+	memset(ops, 0, sizeof(ops));
+	for (i = 0; i < 6; i++) {
+		ops[i].pm_srcva = va;
+		ops[i].pm_dstpgdir = dst;
+		ops[i].pm_dstva = va + i * PGSIZE;
+		ops[i].pm_perm = PTE_U | PTE_P;
+	}
+	ops[1].pm_perm |= PTE_W;		// fine: the page is writable
+	ops[2].pm_srcva = va + PGSIZE;
+	ops[2].pm_perm |= PTE_W;		// read-only page
+	ops[3].pm_srcva = va + 2 * PGSIZE;	// nothing mapped there
+	ops[4].pm_dstva = (void *) UTOP;	// out of range
+	ops[5].pm_perm = PTE_P;			// not PTE_U
+
+	assert(page_map_batch(src, ops, 6) == 2);
+	assert(ops[0].pm_result == 0 && ops[1].pm_result == 0);
+	assert(ops[2].pm_result == -E_INVAL && ops[3].pm_result == -E_INVAL);
+	assert(ops[4].pm_result == -E_INVAL && ops[5].pm_result == -E_INVAL);
+	assert(page_lookup(dst, va, &pte) == pp0 && !(*pte & PTE_W));
+	assert(page_lookup(dst, va + PGSIZE, &pte) == pp0 && (*pte & PTE_W));
+	assert(!page_lookup(dst, va + 2 * PGSIZE, 0));
+	assert(pp0->pp_ref == 3);
+
+	// remapping replaces what was there
+	ops[0].pm_srcva = va + PGSIZE;
+	assert(page_map_batch(src, ops, 1) == 1);
+	assert(page_lookup(dst, va, 0) == pp1);
+	assert(pp0->pp_ref == 2 && pp1->pp_ref == 2);
+
+	pgdir_destroy(dst);
+	pgdir_destroy(src);
+	assert(nfree_pages() == nfree);
+
+	cprintf("check_page_map_batch() succeeded!\n");
+}
@@ -0,0 +1,109 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PMAP_H
+#define JOS_KERN_PMAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+#include <inc/assert.h>
+
+extern struct PageInfo *pages;
+extern size_t npages;
+
+extern pde_t *kern_pgdir;
+
+// The largest block the page allocator hands out is 2^MAX_ORDER pages,
+// which is one 4MB superpage.
+#define MAX_ORDER	(PTSHIFT - PGSHIFT)
+
+/* This macro takes a kernel virtual address -- an address that points above
+ * KERNBASE, where the machine's physical memory is mapped -- and returns the
+ * corresponding physical address.  It panics if you pass it a non-kernel
+ * virtual address.
+ */
+#define PADDR(kva) _paddr(__FILE__, __LINE__, kva)
+
+static inline physaddr_t
+_paddr(const char *file, int line, void *kva)
+{
+	if ((uint32_t)kva < KERNBASE)
+		_panic(file, line, "PADDR called with invalid kva %08lx", kva);
+	return (physaddr_t)kva - KERNBASE;
+}
+
+/* This macro takes a physical address and returns the corresponding kernel
+ * virtual address.  It panics if you pass an invalid physical address. */
+#define KADDR(pa) _kaddr(__FILE__, __LINE__, pa)
+
+static inline void*
+_kaddr(const char *file, int line, physaddr_t pa)
+{
+	if (PGNUM(pa) >= npages)
+		_panic(file, line, "KADDR called with invalid pa %08lx", pa);
+	return (void *)(pa + KERNBASE);
+}
+
+
+enum {
+	// For page_alloc, zero the returned physical page.
+	ALLOC_ZERO = 1<<0,
+};
+
+void	mem_init(void);
+
+void	page_init(void);
+struct PageInfo *page_alloc(int alloc_flags);
+struct PageInfo *page_alloc_order(int order, int alloc_flags);
+void	page_free(struct PageInfo *pp);
+void	page_free_order(struct PageInfo *pp, int order);
+void	page_decref(struct PageInfo *pp);
+void	page_cache_stats(void);
+bool	page_zero_idle(void);
+
+pte_t	*pgdir_walk(pde_t *pgdir, const void *va, int create);
+struct PageInfo *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
+int	page_remove(pde_t *pgdir, void *va);
+int	page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm);
+void	tlb_invalidate(pde_t *pgdir, void *va);
+
+int	pgdir_copy_cow(pde_t *dst, pde_t *src);
+
+// One mapping for page_map_batch: map the page at pm_srcva in the
+// source address space at pm_dstva in pm_dstpgdir with pm_perm.
+struct PageMapOp {
+	void *pm_srcva;
+	pde_t *pm_dstpgdir;
+	void *pm_dstva;
+	int pm_perm;
+	int pm_result;		// set to 0 or -E_*
+};
+
+int	page_map_check(pde_t *srcpgdir, void *srcva, int perm,
+		       struct PageInfo **ppp);
+int	page_map_batch(pde_t *srcpgdir, struct PageMapOp *ops, int n);
+int	page_fault_cow(pde_t *pgdir, void *va);
+void	pgdir_destroy(pde_t *pgdir);
+
+static inline physaddr_t
+page2pa(struct PageInfo *pp)
+{
+	return (pp - pages) << PGSHIFT;
+}
+
+static inline struct PageInfo*
+pa2page(physaddr_t pa)
+{
+	if (PGNUM(pa) >= npages)
+		panic("pa2page called with invalid pa");
+	return &pages[PGNUM(pa)];
+}
+
+static inline void*
+page2kva(struct PageInfo *pp)
+{
+	return KADDR(page2pa(pp));
+}
+
+#endif /* !JOS_KERN_PMAP_H */
@@ -0,0 +1,280 @@
+// Timers on a hierarchical timing wheel.
+//
+// Time is cut into ticks of 2^TICK_SHIFT ns (about a millisecond).
+// Level 0 of the wheel has a slot for each of the next WHEEL_SIZE
+// ticks; each slot of level 1 covers WHEEL_SIZE ticks, each slot of
+// level 2 WHEEL_SIZE^2 ticks, and so on.  A timer goes in the slot
+// covering its expiry on the lowest level that reaches that far, so
+// adding and cancelling a timer is a list insert or delete.  Whenever
+// the clock enters a higher-level slot, its timers "cascade" down into
+// the levels below, and by the time a timer expires it is in level 0.
+//
+// Timers run from timer_run, which the idle loop calls; timer_next
+// says how long the CPU may sleep without missing one.
+
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/timer.h>
+#include <kern/tsc.h>
+
+#define TICK_SHIFT	20
+#define WHEEL_BITS	6
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_LEVELS	4
+#define WHEEL_SPAN	(1ULL << (WHEEL_BITS * WHEEL_LEVELS))	// in ticks
+
+struct TimerWheel {
+	uint64_t tw_now;		// next tick to run
+	uint32_t tw_count;		// pending timers
+	struct Timer *tw_slots[WHEEL_LEVELS][WHEEL_SIZE];
+};
+
+static struct TimerWheel timer_wheel;
+
+static void check_timer(void);
+
+void
+timer_init(void)
+{
+	timer_wheel.tw_now = ktime_ns() >> TICK_SHIFT;
+	check_timer();
+}
+
+static void
+wheel_insert(struct TimerWheel *w, struct Timer *t)
+{
+	struct Timer **slot;
+	uint64_t exp = t->t_expires, delta;
+	int level;
+
+	// A timer that is already due runs on the next tick.  One too far
+	// out for the wheel waits in the farthest slot, and is filed
+	// again from there when that slot cascades.
+	if (exp < w->tw_now)
+		exp = w->tw_now;
+	delta = exp - w->tw_now;
+	if (delta >= WHEEL_SPAN)
+		exp = w->tw_now + WHEEL_SPAN - 1;
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < 1ULL << (WHEEL_BITS * (level + 1)))
+			break;
+
+	slot = &w->tw_slots[level][(exp >> (WHEEL_BITS * level))
+				   & (WHEEL_SIZE - 1)];
+	t->t_link = *slot;
+	t->t_pprev = slot;
+	if (*slot)
+		(*slot)->t_pprev = &t->t_link;
+	*slot = t;
+	w->tw_count++;
+}
+
+static void
+wheel_remove(struct TimerWheel *w, struct Timer *t)
+{
+	*t->t_pprev = t->t_link;
+	if (t->t_link)
+		t->t_link->t_pprev = t->t_pprev;
+	t->t_pprev = NULL;
+	w->tw_count--;
+}
+
+// Take all the timers out of '*slot' into the list at '*list'.
+static void
+wheel_detach(struct Timer **slot, struct Timer **list)
+{
+	*list = *slot;
+	*slot = NULL;
+	if (*list)
+		(*list)->t_pprev = list;
+}
+
+// The earliest tick at which 'w' may have something to do: the
+// expiry of the first timer in level 0, or when the first busy slot
+// in a higher level cascades, whichever comes first.  ~0 if idle.
+static uint64_t
+wheel_next(struct TimerWheel *w)
+{
+	uint64_t next = ~0ULL, tick, block, first;
+	int level, i;
+
+	if (w->tw_count == 0)
+		return next;
+	for (i = 0; i < WHEEL_SIZE; i++) {
+		tick = w->tw_now + i;
+		if (w->tw_slots[0][tick & (WHEEL_SIZE - 1)]) {
+			next = tick;
+			break;
+		}
+	}
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		// the first slot that hasn't cascaded yet
+		first = (w->tw_now + (1ULL << (WHEEL_BITS * level)) - 1)
+			>> (WHEEL_BITS * level);
+		for (i = 0; i < WHEEL_SIZE; i++) {
+			block = first + i;
+			if (w->tw_slots[level][block & (WHEEL_SIZE - 1)]) {
+				next = MIN(next, block << (WHEEL_BITS * level));
+				break;
+			}
+		}
+	}
+	return next;
+}
+
+// Run every timer in 'w' that expires by tick 'now'.
+static void
+wheel_run(struct TimerWheel *w, uint64_t now)
+{
+	struct Timer *list, *t;
+	uint64_t next;
+	int level;
+
+	while (w->tw_now <= now) {
+		// Skip the ticks with nothing to run or cascade.
+		next = wheel_next(w);
+		if (next > w->tw_now) {
+			w->tw_now = MIN(next, now + 1);
+			continue;
+		}
+
+		// Entering a new slot on a higher level: move its timers
+		// down to where they now belong.
+		for (level = 1; level < WHEEL_LEVELS; level++) {
+			if (w->tw_now & ((1ULL << (WHEEL_BITS * level)) - 1))
+				break;
+			wheel_detach(&w->tw_slots[level][(w->tw_now >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)], &list);
+			while ((t = list)) {
+				wheel_remove(w, t);
+				wheel_insert(w, t);
+			}
+		}
+
+		// The callbacks may add and cancel timers, including
+		// ones still on 'list'.
+		wheel_detach(&w->tw_slots[0][w->tw_now & (WHEEL_SIZE - 1)], &list);
+		w->tw_now++;
+		while ((t = list)) {
+			wheel_remove(w, t);
+			t->t_func(t->t_arg);
+		}
+	}
+}
+
+//
+// Arrange for 't' to go off at 'when', in ktime_ns() time.  If it was
+// already pending, the old expiry time no longer counts.
+//
+void
+timer_add(struct Timer *t, uint64_t when)
+{
+	timer_cancel(t);
+	// Round up: a timer may go off late, but never early.  (Adding
+	// a tick's worth of ns first would wrap for 'when' near ~0.)
+	t->t_expires = (when >> TICK_SHIFT)
+		+ ((when & ((1 << TICK_SHIFT) - 1)) != 0);
+	wheel_insert(&timer_wheel, t);
+}
+
+// Stop 't'.  Returns true if it was pending.
+bool
+timer_cancel(struct Timer *t)
+{
+	if (!t->t_pprev)
+		return false;
+	wheel_remove(&timer_wheel, t);
+	return true;
+}
+
+// Run the timers that are due.
+void
+timer_run(void)
+{
+	wheel_run(&timer_wheel, ktime_ns() >> TICK_SHIFT);
+}
+
+// The time before which no timer will go off, in ktime_ns() time, or
+// ~0 if none is pending.  This is when to program a one-shot timer
+// interrupt for.
+uint64_t
+timer_next(void)
+{
+	uint64_t next = wheel_next(&timer_wheel);
+
+	return next == ~0ULL ? next : next << TICK_SHIFT;
+}
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+static struct TimerWheel check_wheel;
+static int check_fired[16];
+static int check_nfired;
+
+static void
+check_timer_fn(void *arg)
+{
+	check_fired[check_nfired++] = (int) arg;
+}
+
+//
+// Drive a private wheel by hand, so that the check doesn't have to
+// wait and doesn't disturb timer_wheel.
+//
+static void
+check_timer(void)
+{
+	static struct Timer t[8];
+	static const uint64_t expires[8] = {
+		0, 1, 63, 64, 100, 4101, WHEEL_SPAN + 10, 50
+	};
+	struct TimerWheel *w = &check_wheel;
+	int i;
+
+	memset(w, 0, sizeof(*w));
+	for (i = 0; i < 8; i++) {
+		t[i].t_func = check_timer_fn;
+		t[i].t_arg = (void *) i;
+		t[i].t_pprev = NULL;
+		t[i].t_expires = expires[i];
+		wheel_insert(w, &t[i]);
+	}
+	assert(w->tw_count == 8);
+	wheel_remove(w, &t[7]);
+	assert(!t[7].t_pprev && w->tw_count == 7);
+
+	assert(wheel_next(w) == 0);
+	wheel_run(w, 0);
+	assert(check_nfired == 1 && check_fired[0] == 0);
+
+	// cascading out of level 1 gets the order right
+	wheel_run(w, 99);
+	assert(check_nfired == 4);
+	assert(check_fired[1] == 1 && check_fired[2] == 2 && check_fired[3] == 3);
+	assert(wheel_next(w) == 100);
+
+	// 4101 sits in level 2 until tick 4096
+	wheel_run(w, 4100);
+	assert(check_nfired == 5 && check_fired[4] == 4);
+	assert(wheel_next(w) == 4101);
+	wheel_run(w, 5000);
+	assert(check_nfired == 6 && check_fired[5] == 5);
+
+	// beyond the wheel's reach, but still on time
+	wheel_run(w, WHEEL_SPAN + 9);
+	assert(check_nfired == 6 && w->tw_count == 1);
+	wheel_run(w, WHEEL_SPAN + 10);
+	assert(check_nfired == 7 && check_fired[6] == 6);
+	assert(w->tw_count == 0 && wheel_next(w) == ~0ULL);
+
+	// "never" doesn't wrap around to "now"
+	timer_add(&t[0], ~0ULL);
+	assert(t[0].t_expires == 1ULL << (64 - TICK_SHIFT));
+	timer_add(&t[0], 1ULL << TICK_SHIFT);
+	assert(t[0].t_expires == 1);
+	assert(timer_cancel(&t[0]) && !timer_cancel(&t[0]));
+
+	cprintf("check_timer() succeeded!\n");
+}
@@ -0,0 +1,27 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TIMER_H
+#define JOS_KERN_TIMER_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// A one-shot timer.  Set t_func and t_arg, then timer_add it; it calls
+// t_func(t_arg) once ktime_ns() reaches the expiry time.
+struct Timer {
+	struct Timer *t_link;
+	struct Timer **t_pprev;		// NULL unless pending
+	uint64_t t_expires;		// in wheel ticks
+	void (*t_func)(void *arg);
+	void *t_arg;
+};
+
+void	timer_init(void);
+void	timer_add(struct Timer *t, uint64_t when);
+bool	timer_cancel(struct Timer *t);
+void	timer_run(void);
+uint64_t timer_next(void);
+
+#endif /* !JOS_KERN_TIMER_H */
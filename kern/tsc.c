@@ -0,0 +1,136 @@
+// The kernel's clock: the time stamp counter, with its frequency
+// measured against the PC's 8253/8254 programmable interval timer,
+// whose input clock runs at a known rate.  tsc_init also publishes the
+// clock at UTIME for user environments (see inc/time.h).
+
+#include <inc/x86.h>
+#include <inc/memlayout.h>
+#include <inc/time.h>
+
+#include <kern/tsc.h>
+#include <kern/pmap.h>
+
+#define PIT_HZ		1193182	// PIT input clock
+#define PIT_CH2		0x42	// channel 2 data port
+#define PIT_MODE	0x43	// mode/command port
+#define PIT_GATE	0x61	// channel 2 gate and output (PC speaker port)
+#define   GATE_CH2	0x01	//   enable channel 2 counting
+#define   GATE_SPKR	0x02	//   drive the speaker from channel 2
+#define   GATE_OUT2	0x20	//   channel 2 output (read only)
+
+#define CAL_MS		10	// calibration interval
+
+static uint64_t tsc_hz;
+static struct TimePage tsc_clock;	// the kernel's copy
+static struct TimePage *time_page;	// the copy mapped at UTIME
+
+static void check_clock(void);
+
+// Count TSC ticks while PIT channel 2 counts down CAL_MS milliseconds
+// in one-shot mode.
+static uint64_t
+tsc_calibrate(void)
+{
+	uint32_t latch = PIT_HZ / (1000 / CAL_MS);
+	uint64_t t0, t1;
+
+	// Gate channel 2 on, with the speaker off.
+	outb(PIT_GATE, (inb(PIT_GATE) & ~GATE_SPKR) | GATE_CH2);
+
+	// Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count):
+	// OUT2 goes high once the count reaches zero.
+	outb(PIT_MODE, 0xB0);
+	outb(PIT_CH2, latch & 0xFF);
+	outb(PIT_CH2, latch >> 8);
+
+	t0 = read_tsc();
+	while (!(inb(PIT_GATE) & GATE_OUT2))
+		/* do nothing */;
+	t1 = read_tsc();
+
+	return (t1 - t0) * (1000 / CAL_MS);
+}
+
+// Return the TSC frequency in Hz, measuring it the first time.
+uint64_t
+tsc_freq(void)
+{
+	if (!tsc_hz)
+		tsc_hz = tsc_calibrate();
+	return tsc_hz;
+}
+
+//
+// Start the clock at zero, and map a read-only copy of its parameters
+// at UTIME.  Needs the page allocator.
+//
+void
+tsc_init(void)
+{
+	struct PageInfo *pp;
+	uint32_t shift;
+
+	// The largest shift (most precision) whose multiplier fits in
+	// 32 bits.
+	tsc_clock.tp_tsc_hz = tsc_freq();
+	for (shift = 32; (1000000000ULL << shift) / tsc_clock.tp_tsc_hz
+			 > 0xFFFFFFFF; shift--)
+		/* do nothing */;
+	tsc_clock.tp_mult = (1000000000ULL << shift) / tsc_clock.tp_tsc_hz;
+	tsc_clock.tp_shift = shift;
+	tsc_clock.tp_ns_base = 0;
+	tsc_clock.tp_tsc_base = read_tsc();
+
+	// UTIME is carved out of the top of the UENVS window.
+	static_assert(UTIME + PGSIZE == UPAGES);
+	static_assert(UENVS + UENVSIZE == UTIME);
+	static_assert(sizeof(struct TimePage) <= PGSIZE);
+	if (!(pp = page_alloc(ALLOC_ZERO))
+	    || page_insert(kern_pgdir, pp, (void *) UTIME, PTE_U) < 0)
+		panic("tsc_init: out of memory");
+	time_page = page2kva(pp);
+	time_page->tp_seq++;
+	asm volatile("" : : : "memory");
+	time_page->tp_mult = tsc_clock.tp_mult;
+	time_page->tp_shift = tsc_clock.tp_shift;
+	time_page->tp_tsc_base = tsc_clock.tp_tsc_base;
+	time_page->tp_ns_base = tsc_clock.tp_ns_base;
+	time_page->tp_tsc_hz = tsc_clock.tp_tsc_hz;
+	asm volatile("" : : : "memory");
+	time_page->tp_seq++;
+
+	check_clock();
+}
+
+// Nanoseconds since tsc_init.
+uint64_t
+ktime_ns(void)
+{
+	return time_tsc2ns(read_tsc() - tsc_clock.tp_tsc_base,
+			   tsc_clock.tp_mult, tsc_clock.tp_shift);
+}
+
+static void
+check_clock(void)
+{
+	const struct TimePage *tp = (const struct TimePage *) UTIME;
+	uint64_t t0, t1, t2, ns;
+
+	// one second's worth of cycles is one second, to within rounding
+	ns = time_tsc2ns(tsc_clock.tp_tsc_hz, tsc_clock.tp_mult,
+			 tsc_clock.tp_shift);
+	assert(ns > 1000000000 - 10 && ns <= 1000000000);
+	// and the conversion doesn't overflow after a long time
+	ns = time_tsc2ns(tsc_clock.tp_tsc_hz * 100000, tsc_clock.tp_mult,
+			 tsc_clock.tp_shift);
+	assert(ns > 100000ULL * (1000000000 - 10) && ns <= 100000ULL * 1000000000);
+
+	// user environments read the same clock through UTIME
+	t0 = ktime_ns();
+	t1 = timepage_ns(tp);
+	t2 = ktime_ns();
+	assert(t0 <= t1 && t1 <= t2);
+	assert(tp->tp_seq == 2);
+
+	cprintf("check_clock() succeeded!\n");
+}
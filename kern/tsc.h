@@ -0,0 +1,15 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TSC_H
+#define JOS_KERN_TSC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+void tsc_init(void);
+uint64_t tsc_freq(void);
+uint64_t ktime_ns(void);
+
+#endif /* !JOS_KERN_TSC_H */
@@ -0,0 +1,213 @@
+// Primary-channel IDE disk access by PIO or PCI bus-master DMA.
+// This code is used by both the boot loader and the kernel, so it
+// must not depend on anything but the hardware.
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/ide.h>
+
+#define PCI_CONF_ADDR	0xCF8
+#define PCI_CONF_DATA	0xCFC
+
+#define PCI_ID_REG		0x00
+#define PCI_COMMAND_REG		0x04
+#define   PCI_COMMAND_IO	0x0001
+#define   PCI_COMMAND_MASTER	0x0004
+#define PCI_CLASS_REG		0x08
+#define PCI_BAR4_REG		0x20
+
+#define PCI_CLASS_MASS_STORAGE	0x01
+#define PCI_SUBCLASS_IDE	0x01
+#define PCI_IDE_BUSMASTER	0x80	// programming interface bit
+
+static uint16_t bm_base;		// bus-master I/O base, 0 if none
+static struct IdePrd *bm_prdt;
+static physaddr_t bm_prdt_pa;
+static bool bm_write;
+
+static uint32_t
+pci_conf_read(uint32_t dev, uint32_t func, uint32_t off)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | (dev << 11) | (func << 8) | off);
+	return inl(PCI_CONF_DATA);
+}
+
+static void
+pci_conf_write(uint32_t dev, uint32_t func, uint32_t off, uint32_t v)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | (dev << 11) | (func << 8) | off);
+	outl(PCI_CONF_DATA, v);
+}
+
+static int
+ide_wait_ready(bool check_error)
+{
+	int r;
+
+	while (((r = inb(IDE_STATUS)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+		/* do nothing */;
+
+	if (check_error && (r & (IDE_DF|IDE_ERR)) != 0)
+		return -E_IO;
+	return 0;
+}
+
+static void
+ide_command(uint32_t secno, size_t nsecs, uint8_t cmd)
+{
+	outb(IDE_NSECT, nsecs);		// 0 means 256
+	outb(IDE_LBA0, secno & 0xFF);
+	outb(IDE_LBA1, (secno >> 8) & 0xFF);
+	outb(IDE_LBA2, (secno >> 16) & 0xFF);
+	outb(IDE_DRIVE, 0xE0 | ((secno >> 24) & 0x0F));
+	outb(IDE_CMD, cmd);
+}
+
+int
+ide_pio_read(uint32_t secno, void *dst, size_t nsecs)
+{
+	int r;
+
+	if (nsecs == 0 || nsecs > IDE_MAXSECT)
+		return -E_INVAL;
+
+	ide_wait_ready(0);
+	ide_command(secno, nsecs, IDE_CMD_READ);
+
+	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
+		if ((r = ide_wait_ready(1)) < 0)
+			return r;
+		insl(IDE_DATA, dst, SECTSIZE/4);
+	}
+
+	return 0;
+}
+
+int
+ide_pio_write(uint32_t secno, const void *src, size_t nsecs)
+{
+	int r;
+
+	if (nsecs == 0 || nsecs > IDE_MAXSECT)
+		return -E_INVAL;
+
+	ide_wait_ready(0);
+	ide_command(secno, nsecs, IDE_CMD_WRITE);
+
+	for (; nsecs > 0; nsecs--, src += SECTSIZE) {
+		if ((r = ide_wait_ready(1)) < 0)
+			return r;
+		outsl(IDE_DATA, src, SECTSIZE/4);
+	}
+
+	return ide_wait_ready(1);
+}
+
+// Look for a bus-master capable IDE controller on PCI bus 0 and make
+// it ready for DMA.  'prdt' is where the caller wants the PRD table
+// to live and 'prdt_pa' is its physical address; it must have room for
+// IDE_NPRD entries.  Returns true if DMA can be used.
+bool
+ide_dma_init(struct IdePrd *prdt, physaddr_t prdt_pa)
+{
+	uint32_t dev, func, class, bar;
+
+	for (dev = 0; dev < 32; dev++)
+		for (func = 0; func < 8; func++) {
+			if ((pci_conf_read(dev, func, PCI_ID_REG) & 0xFFFF) == 0xFFFF)
+				continue;
+			class = pci_conf_read(dev, func, PCI_CLASS_REG);
+			if ((class >> 24) != PCI_CLASS_MASS_STORAGE
+			    || ((class >> 16) & 0xFF) != PCI_SUBCLASS_IDE
+			    || !(class & (PCI_IDE_BUSMASTER << 8)))
+				continue;
+			bar = pci_conf_read(dev, func, PCI_BAR4_REG);
+			if (!(bar & 1) || (bar & 0xFFFC) == 0)
+				continue;
+
+			// Make sure the controller decodes its I/O ports and
+			// is allowed to master the bus.  The upper half of the
+			// register is write-1-to-clear status, so leave it 0.
+			pci_conf_write(dev, func, PCI_COMMAND_REG,
+				       (pci_conf_read(dev, func, PCI_COMMAND_REG)
+					& 0xFFFF)
+				       | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+			bm_base = bar & 0xFFFC;
+			bm_prdt = prdt;
+			bm_prdt_pa = prdt_pa;
+			outb(bm_base + BM_CMD, 0);
+			return true;
+		}
+	return false;
+}
+
+// Start a DMA transfer of 'nsecs' sectors between sector 'secno' and
+// physical memory at 'pa', and return without waiting for it.  Only
+// one transfer can be in flight; finish it with ide_dma_poll or
+// ide_dma_wait before starting another one or touching the buffer.
+int
+ide_dma_start(uint32_t secno, physaddr_t pa, size_t nsecs, bool write)
+{
+	size_t len, n;
+	int i;
+
+	if (!bm_base)
+		return -E_INVAL;
+	if (nsecs == 0 || nsecs > IDE_MAXSECT || (pa & 1))
+		return -E_INVAL;
+
+	// Describe the buffer, splitting it at 64KB boundaries.
+	len = nsecs * SECTSIZE;
+	for (i = 0; len > 0; i++) {
+		n = MIN(len, 0x10000 - (pa & 0xFFFF));
+		bm_prdt[i].prd_addr = pa;
+		bm_prdt[i].prd_count = n & 0xFFFF;
+		bm_prdt[i].prd_flags = 0;
+		pa += n;
+		len -= n;
+	}
+	bm_prdt[i - 1].prd_flags = PRD_EOT;
+
+	bm_write = write;
+	outb(bm_base + BM_CMD, 0);
+	outl(bm_base + BM_PRDT, bm_prdt_pa);
+	outb(bm_base + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+	outb(bm_base + BM_CMD, write ? 0 : BM_CMD_READ);
+
+	ide_wait_ready(0);
+	ide_command(secno, nsecs, write ? IDE_CMD_WRITE_DMA : IDE_CMD_READ_DMA);
+
+	outb(bm_base + BM_CMD, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+	return 0;
+}
+
+// Check on the transfer started by ide_dma_start.  Returns 1 if it is
+// still running, 0 once it has completed, or a negative error code.
+int
+ide_dma_poll(void)
+{
+	uint8_t st;
+
+	st = inb(bm_base + BM_STATUS);
+	if ((st & BM_ST_ACTIVE) && !(st & (BM_ST_ERR | BM_ST_INTR)))
+		return 1;
+
+	outb(bm_base + BM_CMD, bm_write ? 0 : BM_CMD_READ);
+	outb(bm_base + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+
+	// Reading the drive status also acknowledges its interrupt.
+	if ((st & BM_ST_ERR) || ide_wait_ready(1) < 0)
+		return -E_IO;
+	return 0;
+}
+
+int
+ide_dma_wait(void)
+{
+	int r;
+
+	while ((r = ide_dma_poll()) > 0)
+		/* do nothing */;
+	return r;
+}